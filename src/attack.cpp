@@ -1,8 +1,239 @@
 #include "bitboard.h"
+#include <chrono>
+#include <immintrin.h>
+#include <iostream>
+#include <vector>
 #include "main.h"
 #include "attack.h"
+#include "cpu.h"
+
+#if defined(__GNUC__)
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
 
 namespace attack{
+  namespace{
+    constexpr u64 fill_shift[n_dirs]={9,8,7,1,7,8,9,1};
+    constexpr u64 fill_mask[n_dirs]={
+    ~filea.data,~SCU64(0),~fileh.data,~filea.data,
+    ~filea.data,~SCU64(0),~fileh.data,~fileh.data
+    };
+
+    u64 soft_pext(const u64 b,u64 mask){
+      u64 r=0;
+      for(u64 bit=1;mask;bit<<=1){
+        if(b&mask&(0-mask)) r|=bit;
+        mask&=mask-1;
+      }
+      return r;
+    }
+
+    u64 sparse_rand(u64& s){
+      u64 r=~SCU64(0);
+      for(int i=0;i<3;++i){
+        s^=s>>12;
+        s^=s<<25;
+        s^=s>>27;
+        r&=s*0x2545f4914f6cdd1d;
+      }
+      return r;
+    }
+
+    template<i32 Pt> void init_magics(magic* magics,bitboard* magic_table,bitboard* pext_table){
+      static bitboard occupancy[4096];
+      static bitboard reference[4096];
+      static int epoch[4096];
+      int attempt=0;
+      u64 seed=0x9e3779b97f4a7c15;
+      size_t offset=0;
+      for(u8 sq=a1;sq<n_sqs;++sq){
+        magic& m=magics[sq];
+        const bitboard edges=(rank1|rank8)-ranks[rmake(sq)]|(filea|fileh)-files[fmake(sq)];
+        m.mask=kindergarten_atts<Pt>(sq,0)-edges;
+        m.shift=SCU8(64-popcnt(m.mask));
+        if(magic_table) m.magic_atts=magic_table+offset;
+        if(pext_table) m.pext_atts=pext_table+offset;
+        int size=0;
+        bitboard b=0;
+        do{
+          occupancy[size]=b;
+          reference[size]=kindergarten_atts<Pt>(sq,b);
+          if(pext_table) m.pext_atts[soft_pext(b.data,m.mask.data)]=reference[size];
+          ++size;
+          b=b.data-m.mask.data&m.mask.data;
+        } while(b);
+        offset+=SCSZ(size);
+        if(!magic_table) continue;
+        for(int i=0;i<size;){
+          do m.factor=sparse_rand(seed);
+          while(popcnt(m.factor*m.mask.data>>56)<6);
+          for(++attempt,i=0;i<size;++i){
+            const u32 idx=m.magic_index(occupancy[i]);
+            if(epoch[idx]<attempt){
+              epoch[idx]=attempt;
+              m.magic_atts[idx]=reference[i];
+            } else if(m.magic_atts[idx]!=reference[i]) break;
+          }
+        }
+      }
+    }
+
+    template<bitboard(*Atts)(u8,bitboard)> u64 lookup_loop(const std::vector<bitboard>& occs,const int rounds){
+      u64 sum=0;
+      for(int r=0;r<rounds;++r){
+        for(size_t i=0;i<occs.size();++i) sum+=Atts(SCU8(i&63),occs[i]).data;
+      }
+      return sum;
+    }
+
+    u64 setwise_lookup_loop(const std::vector<bitboard>& occs,const int rounds){
+      u64 sum=0;
+      for(int r=0;r<rounds;++r){
+        for(size_t i=0;i<occs.size();++i){
+          bitboard sliders=occs[i]&occs[i^1];
+          bitboard atts{};
+          while(sliders) atts|=attack::atts<queen>(pop_lsb(sliders),occs[i]);
+          sum+=atts.data;
+        }
+      }
+      return sum;
+    }
+
+    template<fill_fn Fills> u64 setwise_fill_loop(const std::vector<bitboard>& occs,const int rounds){
+      u64 sum=0;
+      bitboard out[n_dirs];
+      for(int r=0;r<rounds;++r){
+        for(size_t i=0;i<occs.size();++i){
+          const bitboard sliders=occs[i]&occs[i^1];
+          Fills(sliders,sliders,~occs[i],out);
+          bitboard atts{};
+          for(const auto& b:out) atts|=b;
+          sum+=atts.data;
+        }
+      }
+      return sum;
+    }
+
+    TARGET("bmi2") u64 pext_loop(const std::vector<bitboard>& occs,const int rounds){
+      u64 sum=0;
+      for(int r=0;r<rounds;++r){
+        for(size_t i=0;i<occs.size();++i){
+          const magic& bm=bishop_magics[i&63];
+          const magic& rm=rook_magics[i&63];
+          sum+=(bm.pext_atts[_pext_u64(occs[i].data,bm.mask.data)]|
+            rm.pext_atts[_pext_u64(occs[i].data,rm.mask.data)]).data;
+        }
+      }
+      return sum;
+    }
+  }
+
+  void bench(){
+    constexpr int n_occs=1<<14;
+    constexpr int rounds=200;
+    std::vector<bitboard> occs(n_occs);
+    u64 seed=0x2f1e3d5c7b9a8604;
+    for(auto& occ:occs){
+      occ=sparse_rand(seed)|sparse_rand(seed);
+      occ.set(SCU8(&occ-occs.data()&63));
+    }
+    const char* selected=
+#if defined(USE_PEXT)
+      "pext";
+#elif defined(USE_MAGIC)
+      "magic";
+#else
+      "kindergarten";
+#endif
+    u64 expected=0;
+    const char* unit="queen";
+    auto run=[&](const char* name,auto loop){
+      const auto begin=std::chrono::steady_clock::now();
+      const u64 sum=loop(occs,rounds);
+      const auto end=std::chrono::steady_clock::now();
+      const double ns=std::chrono::duration<double,std::nano>(end-begin).count()/(SCDO(n_occs)*rounds);
+      if(!expected) expected=sum;
+      SO<<name<<" "<<ns<<" ns/"<<unit<<(sum==expected?"":" mismatch")<<NL;
+    };
+    if(!bishop_magics[a1].magic_atts){
+      init_magics<bishop>(bishop_magics,bishop_magic_table,nullptr);
+      init_magics<rook>(rook_magics,rook_magic_table,nullptr);
+    }
+    if(!bishop_magics[a1].pext_atts){
+      init_magics<bishop>(bishop_magics,nullptr,bishop_pext_table);
+      init_magics<rook>(rook_magics,nullptr,rook_pext_table);
+    }
+    SO<<"sliders "<<selected<<NL;
+    run("kindergarten",lookup_loop<kindergarten_atts<queen>>);
+    run("magic",lookup_loop<magic_atts<queen>>);
+    if(cpu::detect().bmi2) run("pext",pext_loop);
+    else SO<<"pext unsupported"<<NL;
+    expected=0;
+    unit="set";
+    SO<<"setwise "<<(slider_fills==slider_fills_avx2?"avx2":"scalar")<<NL;
+    run("lookup",setwise_lookup_loop);
+    run("fill scalar",setwise_fill_loop<slider_fills_scalar>);
+    if(cpu::detect().avx2) run("fill avx2",setwise_fill_loop<slider_fills_avx2>);
+    else SO<<"avx2 unsupported"<<NL;
+  }
+
+  void slider_fills_scalar(const bitboard orth,const bitboard diag,const bitboard empty,bitboard* out){
+    for(int d=0;d<n_dirs;++d){
+      const int s=SCI(fill_shift[d]);
+      const u64 m=fill_mask[d];
+      u64 gen=(d&1?orth:diag).data;
+      u64 pro=empty.data&m;
+      if(d<southeast){
+        gen|=pro&gen<<s;
+        pro&=pro<<s;
+        gen|=pro&gen<<2*s;
+        pro&=pro<<2*s;
+        gen|=pro&gen<<4*s;
+        out[d]=gen<<s&m;
+      } else{
+        gen|=pro&gen>>s;
+        pro&=pro>>s;
+        gen|=pro&gen>>2*s;
+        pro&=pro>>2*s;
+        gen|=pro&gen>>4*s;
+        out[d]=gen>>s&m;
+      }
+    }
+  }
+
+  TARGET("avx2") void slider_fills_avx2(const bitboard orth,const bitboard diag,const bitboard empty,bitboard* out){
+    const __m256i gen0=_mm256_set_epi64x(SC<i64>(orth.data),SC<i64>(diag.data),SC<i64>(orth.data),SC<i64>(diag.data));
+    const __m256i occl=_mm256_set1_epi64x(SC<i64>(empty.data));
+    const __m256i s1_up=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(fill_shift));
+    const __m256i s1_down=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(fill_shift+4));
+    const __m256i s2_up=_mm256_add_epi64(s1_up,s1_up);
+    const __m256i s2_down=_mm256_add_epi64(s1_down,s1_down);
+    const __m256i s4_up=_mm256_add_epi64(s2_up,s2_up);
+    const __m256i s4_down=_mm256_add_epi64(s2_down,s2_down);
+    const __m256i m_up=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(fill_mask));
+    const __m256i m_down=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(fill_mask+4));
+    __m256i up=gen0;
+    __m256i down=gen0;
+    __m256i pro_up=_mm256_and_si256(occl,m_up);
+    __m256i pro_down=_mm256_and_si256(occl,m_down);
+    up=_mm256_or_si256(up,_mm256_and_si256(pro_up,_mm256_sllv_epi64(up,s1_up)));
+    down=_mm256_or_si256(down,_mm256_and_si256(pro_down,_mm256_srlv_epi64(down,s1_down)));
+    pro_up=_mm256_and_si256(pro_up,_mm256_sllv_epi64(pro_up,s1_up));
+    pro_down=_mm256_and_si256(pro_down,_mm256_srlv_epi64(pro_down,s1_down));
+    up=_mm256_or_si256(up,_mm256_and_si256(pro_up,_mm256_sllv_epi64(up,s2_up)));
+    down=_mm256_or_si256(down,_mm256_and_si256(pro_down,_mm256_srlv_epi64(down,s2_down)));
+    pro_up=_mm256_and_si256(pro_up,_mm256_sllv_epi64(pro_up,s2_up));
+    pro_down=_mm256_and_si256(pro_down,_mm256_srlv_epi64(pro_down,s2_down));
+    up=_mm256_or_si256(up,_mm256_and_si256(pro_up,_mm256_sllv_epi64(up,s4_up)));
+    down=_mm256_or_si256(down,_mm256_and_si256(pro_down,_mm256_srlv_epi64(down,s4_down)));
+    up=_mm256_and_si256(_mm256_sllv_epi64(up,s1_up),m_up);
+    down=_mm256_and_si256(_mm256_srlv_epi64(down,s1_down),m_down);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),up);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out+4),down);
+  }
+
   void init(){
     for(u8 from=a1;from<n_sqs;++from){
       auto atts=bitboard();
@@ -88,6 +319,12 @@ namespace attack{
         for(const auto& arr:ray_att){
           if(arr[i]&b){
             in_between_sqs[i][j]=arr[i]-arr[j]-b;
+            for(const auto& back:ray_att){
+              if(back[j].is_set(i)){
+                line_bb[i][j]=arr[i]|back[j]|bitboard::from_sq(i);
+                break;
+              }
+            }
             break;
           }
         }
@@ -148,5 +385,13 @@ namespace attack{
         }
       }
     }
+#if defined(USE_PEXT)
+    init_magics<bishop>(bishop_magics,nullptr,bishop_pext_table);
+    init_magics<rook>(rook_magics,nullptr,rook_pext_table);
+#elif defined(USE_MAGIC)
+    init_magics<bishop>(bishop_magics,bishop_magic_table,nullptr);
+    init_magics<rook>(rook_magics,rook_magic_table,nullptr);
+#endif
+    if(cpu::detect().avx2) slider_fills=slider_fills_avx2;
   }
 }
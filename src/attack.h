@@ -1,6 +1,12 @@
 #pragma once
 #include "bitboard.h"
 
+#if defined(USE_PEXT)
+#include <immintrin.h>
+#elif !defined(USE_KINDERGARTEN)
+#define USE_MAGIC
+#endif
+
 namespace attack{
   inline bitboard files[8]={
   filea,fileb,filec,filed,
@@ -33,12 +39,41 @@ namespace attack{
   inline bitboard first_rank_att[8][64];
   inline bitboard in_between_sqs[n_sqs][n_sqs];
   inline bitboard king_att[n_sqs];
+  inline bitboard line_bb[n_sqs][n_sqs];
   inline bitboard knight_att[n_sqs];
   inline bitboard pawn_att[n_colors][n_sqs];
   inline bitboard ranks_by_sq[n_sqs];
   inline bitboard ray_att[n_dirs][n_sqs];
   inline bitboard rook_att[n_sqs];
 
+  constexpr size_t bishop_table_size=0x1480;
+  constexpr size_t rook_table_size=0x19000;
+
+  struct magic{
+    bitboard mask;
+    u64 factor;
+    bitboard* magic_atts;
+    bitboard* pext_atts;
+    u8 shift;
+
+    [[nodiscard]] u32 magic_index(const bitboard occ) const{
+      return SC<u32>((occ&mask).data*factor>>shift);
+    }
+
+#if defined(USE_PEXT)
+    [[nodiscard]] u32 pext_index(const bitboard occ) const{
+      return SC<u32>(_pext_u64(occ.data,mask.data));
+    }
+#endif
+  };
+
+  inline magic bishop_magics[n_sqs];
+  inline magic rook_magics[n_sqs];
+  inline bitboard bishop_magic_table[bishop_table_size];
+  inline bitboard rook_magic_table[rook_table_size];
+  inline bitboard bishop_pext_table[bishop_table_size];
+  inline bitboard rook_pext_table[rook_table_size];
+
   inline bitboard diag_att(const u8 sq,bitboard occ){
     occ=diag_by_sq[sq]&occ;
     occ=occ*fileb>>58;
@@ -63,7 +98,7 @@ namespace attack{
     return a_file_att[rmake(sq)][occ.data]<<fmake(sq);
   }
 
-  template<i32 Pt> bitboard atts(const u8 sq,const bitboard occupied){
+  template<i32 Pt> bitboard kindergarten_atts(const u8 sq,const bitboard occupied){
     switch(Pt){
     case bishop: return diag_att(sq,occupied)|anti_diag_att(sq,occupied);
     case rook: return file_att(sq,occupied)|rank_att(sq,occupied);
@@ -74,11 +109,45 @@ namespace attack{
     return {};
   }
 
+  template<i32 Pt> bitboard magic_atts(const u8 sq,const bitboard occupied){
+    if constexpr(Pt==queen) return magic_atts<bishop>(sq,occupied)|magic_atts<rook>(sq,occupied);
+    else{
+      const magic& m=Pt==bishop?bishop_magics[sq]:rook_magics[sq];
+      return m.magic_atts[m.magic_index(occupied)];
+    }
+  }
+
+#if defined(USE_PEXT)
+  template<i32 Pt> bitboard pext_atts(const u8 sq,const bitboard occupied){
+    if constexpr(Pt==queen) return pext_atts<bishop>(sq,occupied)|pext_atts<rook>(sq,occupied);
+    else{
+      const magic& m=Pt==bishop?bishop_magics[sq]:rook_magics[sq];
+      return m.pext_atts[m.pext_index(occupied)];
+    }
+  }
+#endif
+
+  template<i32 Pt> bitboard atts(const u8 sq,const bitboard occupied){
+#if defined(USE_PEXT)
+    return pext_atts<Pt>(sq,occupied);
+#elif defined(USE_MAGIC)
+    return magic_atts<Pt>(sq,occupied);
+#else
+    return kindergarten_atts<Pt>(sq,occupied);
+#endif
+  }
+
   template<bool C> bitboard pawn_att_bb(const bitboard b){
     return C==white
       ?b.shift<7>()|b.shift<9>()
       :b.shift<-9>()|b.shift<-7>();
   }
 
+  using fill_fn=void(*)(bitboard orth,bitboard diag,bitboard empty,bitboard* out);
+  void slider_fills_scalar(bitboard orth,bitboard diag,bitboard empty,bitboard* out);
+  void slider_fills_avx2(bitboard orth,bitboard diag,bitboard empty,bitboard* out);
+  inline fill_fn slider_fills=slider_fills_scalar;
+
+  void bench();
   void init();
 }
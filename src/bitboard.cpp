@@ -7,10 +7,16 @@
 #include "eval.h"
 
 board::board(const std::string& fen){
-  board_status.reserve(256);
-  board_status.clear();
-  board_status.emplace_back();
-  st=get_board_status();
+  set(fen);
+}
+
+void board::set(const std::string& fen){
+  std::fill(std::begin(pos),std::end(pos),no_piece);
+  std::fill(std::begin(piece_bb),std::end(piece_bb),bitboard{});
+  std::fill(std::begin(color_bb),std::end(color_bb),bitboard{});
+  occupied_bb={};
+  st=states;
+  *st=board_state{};
   std::istringstream ss(fen);
   std::string token;
   ss>>token;
@@ -48,7 +54,15 @@ board::board(const std::string& fen){
   ss>>st->fifty_move_count;
   ss>>st->ply_count;
   st->ply_count=2*(st->ply_count-1)+side_to_move;
-  st->zobrist=42;
+  st->zobrist=zobrist::castle[st->castles.data];
+  if(side_to_move==black) st->zobrist^=zobrist::side;
+  if(st->ep_sq) st->zobrist^=zobrist::en_passant[fmake(st->ep_sq)];
+  bitboard occ=occupied();
+  while(occ){
+    const u8 s=pop_lsb(occ);
+    st->zobrist^=zobrist::psq[piece_on(s)][s];
+  }
+  gen_king_attack_info(st->king_attacinfo);
 }
 
 board::board(const board& other){
@@ -62,11 +76,19 @@ board& board::operator=(const board& other){
   std::memcpy(color_bb,other.color_bb,n_colors*sizeof(bitboard));
   occupied_bb=other.occupied_bb;
   side_to_move=other.side_to_move;
-  board_status=other.board_status;
-  st=get_board_status();
+  const int n=other.recent_states();
+  std::copy(other.st-n+1,other.st+1,states);
+  st=states+n-1;
   return *this;
 }
 
+void board::trim_history(){
+  if(history_size()<max_history) return;
+  const int n=recent_states();
+  std::copy(st-n+1,st+1,states);
+  st=states+n-1;
+}
+
 std::ostream& operator<<(std::ostream& os,const board& pos){
   const std::string sp=" ";
   for(i8 r=rank_8;r>=rank_1;--r){
@@ -142,7 +164,7 @@ void board::apply_move(const u16 m){
   const bool us=side_to_move;
   const bool them=!us;
   const i32 push=pawn_push(us);
-  board_state bs;
+  board_state& bs=st[1];
   bs.ply_count=st->ply_count+1;
   bs.fifty_move_count=st->fifty_move_count+1;
   bs.castles=st->castles;
@@ -151,7 +173,12 @@ void board::apply_move(const u16 m){
   bs.captured=
     mt==move::en_passant?pmake(them,pawn):piece_on(to);
   bs.move=m;
-  bs.king_attacinfo.computed=false;
+  bs.nnue.accumulator.computed_accumulation=0;
+  dirty_piece& dp=bs.nnue.dirty_piece;
+  dp.dirty_num=1;
+  dp.pc[0]=piece_map[pc];
+  dp.from[0]=from;
+  dp.to[0]=to;
   if(st->ep_sq){
     st->zobrist^=zobrist::en_passant[fmake(st->ep_sq)];
   }
@@ -159,6 +186,9 @@ void board::apply_move(const u16 m){
     bs.fifty_move_count=0;
     u8 capsq=to;
     if(mt==move::en_passant) capsq-=SCU8(push);
+    dp.pc[dp.dirty_num]=piece_map[bs.captured];
+    dp.from[dp.dirty_num]=capsq;
+    dp.to[dp.dirty_num++]=n_sqs;
     remove_piece(capsq);
     if(bs.captured==pmake(them,rook)){
       if(to==relative(us,a8)){
@@ -183,15 +213,13 @@ void board::apply_move(const u16 m){
     bs.castles.reset(us?black_castle:white_castle);
     st->zobrist^=zobrist::castle[bs.castles.data];
     if(mt==move::castle){
-      if(to==relative(us,c1)){
-        const u8 rfrom=relative(us,a1);
-        const u8 rto=relative(us,d1);
-        move_piece(rfrom,rto);
-      } else if(to==relative(us,g1)){
-        const u8 rfrom=relative(us,h1);
-        const u8 rto=relative(us,f1);
-        move_piece(rfrom,rto);
-      }
+      const bool is_ks=to==relative(us,g1);
+      const u8 rfrom=relative(us,is_ks?h1:a1);
+      const u8 rto=relative(us,is_ks?f1:d1);
+      dp.pc[dp.dirty_num]=piece_map[pmake(us,rook)];
+      dp.from[dp.dirty_num]=rfrom;
+      dp.to[dp.dirty_num++]=rto;
+      move_piece(rfrom,rto);
     }
   } else if(pt==rook){
     if(from==relative(us,a1)){
@@ -208,23 +236,65 @@ void board::apply_move(const u16 m){
     remove_piece(from);
     pc=pmake(us,move::get_piece_type(m));
     set_piece(pc,to);
+    dp.to[0]=n_sqs;
+    dp.pc[dp.dirty_num]=piece_map[pc];
+    dp.from[dp.dirty_num]=n_sqs;
+    dp.to[dp.dirty_num++]=to;
   } else{
     move_piece(from,to);
   }
   st->zobrist^=zobrist::side;
   side_to_move=!side_to_move;
   bs.repetitions=0;
-  for(int i=SCI(board_status.size())-4;
-      i>SCI(board_status.size())-bs.fifty_move_count-1;i-=2){
-    if(i<=0) break;
-    if(board_status[i].zobrist==st->zobrist){
-      bs.repetitions=board_status[i].repetitions+1;
+  const int size=history_size();
+  for(int i=size-4;i>size-bs.fifty_move_count-1;i-=2){
+    if(i<0) break;
+    if(states[i].zobrist==st->zobrist){
+      bs.repetitions=states[i].repetitions+1;
       break;
     }
   }
   std::swap(st->zobrist,bs.zobrist);
-  board_status.push_back(bs);
-  st=get_board_status();
+  ++st;
+  gen_king_attack_info(st->king_attacinfo);
+}
+
+u64 board::key_after(const u16 m) const{
+  const u8 from=move::from(m);
+  const u8 to=move::to(m);
+  const move::move_type mt=move::mt(m);
+  const i32 pc=piece_on(from);
+  const bool us=side_to_move;
+  const i32 push=pawn_push(us);
+  castle castles=st->castles;
+  u64 key=st->zobrist^zobrist::side;
+  if(st->ep_sq) key^=zobrist::en_passant[fmake(st->ep_sq)];
+  if(const i32 captured=piece_on(to)){
+    key^=zobrist::psq[captured][to];
+    if(captured==pmake(!us,rook)){
+      if(to==relative(us,a8)) castles.reset(us?white_qs:black_qs);
+      else if(to==relative(us,h8)) castles.reset(us?white_ks:black_ks);
+    }
+  } else if(mt==move::en_passant){
+    key^=zobrist::psq[pmake(!us,pawn)][to-push];
+  }
+  key^=zobrist::psq[pc][from];
+  key^=zobrist::psq[mt==move::promotion?pmake(us,move::get_piece_type(m)):pc][to];
+  if(const i32 pt=ptmake(pc);pt==pawn){
+    if(to-from==2*push) key^=zobrist::en_passant[fmake(to-push)];
+  } else if(pt==king){
+    castles.reset(us?black_castle:white_castle);
+    if(mt==move::castle){
+      const bool is_ks=to==relative(us,g1);
+      const i32 rook_pc=pmake(us,rook);
+      key^=zobrist::psq[rook_pc][relative(us,is_ks?h1:a1)];
+      key^=zobrist::psq[rook_pc][relative(us,is_ks?f1:d1)];
+    }
+  } else if(pt==rook){
+    if(from==relative(us,a1)) castles.reset(us?black_qs:white_qs);
+    else if(from==relative(us,h1)) castles.reset(us?black_ks:white_ks);
+  }
+  return key^zobrist::castle[st->castles.data]^zobrist::castle[castles.data];
 }
 
 void board::undo_move(){
@@ -248,89 +318,63 @@ void board::undo_move(){
     move_piece<false>(to,from);
   } else move_piece<false>(to,from);
   if(st->captured) set_piece<false>(st->captured,to);
-  board_status.pop_back();
-  st=get_board_status();
+  --st;
 }
 
 void board::apply_null_move(){
-  board_state bs;
+  board_state& bs=st[1];
   bs.ply_count=st->ply_count;
   bs.fifty_move_count=st->fifty_move_count;
   bs.castles=st->castles;
+  bs.zobrist=st->zobrist^zobrist::side;
+  if(st->ep_sq) bs.zobrist^=zobrist::en_passant[fmake(st->ep_sq)];
   bs.repetitions=0;
   bs.ep_sq=no_sq;
   bs.captured=no_piece;
   bs.move=0;
-  bs.king_attacinfo.computed=false;
-  board_status.push_back(bs);
-  st=get_board_status();
+  bs.nnue.accumulator.computed_accumulation=0;
+  bs.nnue.dirty_piece.dirty_num=0;
+  bs.nnue.dirty_piece.pc[0]=blank;
+  ++st;
   side_to_move=!side_to_move;
+  gen_king_attack_info(st->king_attacinfo);
 }
 
 void board::undo_null_move(){
   side_to_move=!side_to_move;
-  board_status.pop_back();
-  st=get_board_status();
+  --st;
 }
 
 bool board::gives_check(const u16 m) const{
-  const bitboard their_king_bb=get_pieces(!side_to_move,king);
-  const u8 ksq=lsb(their_king_bb);
+  const king_attack_info& k=st->king_attacinfo;
+  const bool us=side_to_move;
+  const u8 their_ksq=ksq(!us);
   const u8 from=move::from(m);
   const u8 to=move::to(m);
-  const move::move_type mt=move::mt(m);
-  i32 pt=ptmake(piece_on(from));
-  bitboard occ=occupied_bb;
-  if(mt==move::promotion){
-    occ.clear(from);
-    pt=move::get_piece_type(m);
-  }
-  bitboard attacked;
-  switch(pt){
-  case pawn:{
-    attacked=attack::pawn_att[side_to_move][to];
-    break;
-  }
-  case knight:{
-    attacked=attack::knight_att[to];
-    break;
-  }
-  case bishop:{
-    attacked=attack::atts<bishop>(to,occ);
-    break;
-  }
-  case rook:{
-    attacked=attack::atts<rook>(to,occ);
-    break;
+  if(k.check_sqs[ptmake(piece_on(from))].is_set(to)) return true;
+  if(k.discovered.is_set(from)&&!attack::line_bb[their_ksq][from].is_set(to)) return true;
+  switch(move::mt(m)){
+  case move::promotion:{
+    const bitboard occ=occupied_bb-bitboard::from_sq(from);
+    switch(move::get_piece_type(m)){
+    case knight: return attack::knight_att[to].is_set(their_ksq);
+    case bishop: return attack::atts<bishop>(to,occ).is_set(their_ksq);
+    case rook: return attack::atts<rook>(to,occ).is_set(their_ksq);
+    default: return attack::atts<queen>(to,occ).is_set(their_ksq);
+    }
   }
-  case queen:{
-    attacked=attack::atts<queen>(to,occ);
-    break;
+  case move::en_passant:{
+    const u8 capsq=to-SCU8(pawn_push(us));
+    const bitboard occ=occupied_bb^bitboard::from_sq(from)^bitboard::from_sq(capsq)|bitboard::from_sq(to);
+    return attack::atts<rook>(their_ksq,occ)&(get_pieces(us,rook)|get_pieces(us,queen))||
+      attack::atts<bishop>(their_ksq,occ)&(get_pieces(us,bishop)|get_pieces(us,queen));
   }
-  default: attacked={};
+  case move::castle:{
+    const u8 rto=relative(us,to>from?f1:d1);
+    return attack::atts<rook>(rto,occupied_bb-bitboard::from_sq(from)).is_set(their_ksq);
   }
-  if(attacked&their_king_bb) return true;
-  if(mt==move::castle){
-    occ.clear(from);
-    if(const u8 rsq=side_to_move==white
-      ?to>from
-      ?f1
-      :d1
-      :to>from
-      ?f8
-      :d8;attack::atts<rook>(rsq,occ)&their_king_bb)
-      return true;
-  } else if(mt==move::en_passant){
-    occ.clear(from);
-    occ.clear(SCU8(to-pawn_push(side_to_move)));
-    occ.set(to);
-    if(is_under_attack(!side_to_move,ksq)) return true;
-  } else{
-    occ.clear(from);
-    occ.set(to);
-    if(is_under_attack(!side_to_move,ksq)) return true;
+  default: return false;
   }
-  return false;
 }
 
 bool board::is_pseudo_legal(const u16 m) const{
@@ -413,36 +457,40 @@ bool board::is_pseudo_legal(const u16 m) const{
 }
 
 void board::gen_king_attack_info(king_attack_info& k) const{
-  k.computed=true;
-  const bool them=!side_to_move;
-  const u8 ksq=this->ksq(side_to_move);
-  const bitboard our_team=get_color(side_to_move);
-  const bitboard their_team=get_color(them);
+  const bool us=side_to_move;
+  const bool them=!us;
+  const u8 ksq=this->ksq(us);
+  const u8 their_ksq=this->ksq(them);
+  const bitboard occ=occupied();
+  const bitboard bishops=get_pieces(bishop)|get_pieces(queen);
+  const bitboard rooks=get_pieces(rook)|get_pieces(queen);
+  k.checkers=attackers_to(ksq,occ)&get_color(them);
+  k.atts=k.checkers;
+  k.double_check=popcnt(k.checkers)>1;
   k.pinned={};
-  k.atts=
-    their_team&(attack::pawn_att[side_to_move][ksq]&get_pieces(pawn)|
-      attack::knight_att[ksq]&get_pieces(knight));
-  int attacker_count=popcnt(k.atts);
-  bitboard slider_attackers=
-    their_team&
-    (attack::atts<bishop>(ksq,their_team)&
-      (get_pieces(bishop)|get_pieces(queen))|
-      attack::atts<rook>(ksq,their_team)&(get_pieces(rook)|get_pieces(queen)));
-  while(slider_attackers){
-    const u8 s=pop_lsb(slider_attackers);
+  k.discovered={};
+  bitboard snipers=get_color(them)&(attack::bishop_att[ksq]&bishops|attack::rook_att[ksq]&rooks);
+  while(snipers){
+    const u8 s=pop_lsb(snipers);
     const bitboard between=attack::in_between_sqs[ksq][s];
-    const bitboard blockers=between&our_team;
-    if(const auto num_blockers=popcnt(blockers);num_blockers==0){
-      ++attacker_count;
-      k.atts|=between;
-      k.atts|=bitboard::from_sq(s);
-    } else if(num_blockers==1) k.pinned.set(lsb(blockers));
+    const bitboard blockers=between&occ;
+    if(!blockers) k.atts|=between;
+    else if(popcnt(blockers)==1&&blockers&get_color(us)) k.pinned|=blockers;
   }
-  k.double_check=attacker_count==2;
+  snipers=get_color(us)&(attack::bishop_att[their_ksq]&bishops|attack::rook_att[their_ksq]&rooks);
+  while(snipers){
+    const bitboard blockers=attack::in_between_sqs[their_ksq][pop_lsb(snipers)]&occ;
+    if(popcnt(blockers)==1&&blockers&get_color(us)) k.discovered|=blockers;
+  }
+  k.check_sqs[pawn]=attack::pawn_att[them][their_ksq];
+  k.check_sqs[knight]=attack::knight_att[their_ksq];
+  k.check_sqs[bishop]=attack::atts<bishop>(their_ksq,occ);
+  k.check_sqs[rook]=attack::atts<rook>(their_ksq,occ);
+  k.check_sqs[queen]=k.check_sqs[bishop]|k.check_sqs[rook];
+  k.check_sqs[king]={};
 }
 
 bool board::is_legal(const u16 m){
-  if(!st->king_attacinfo.computed) gen_king_attack_info(st->king_attacinfo);
   const u8 from=move::from(m);
   const u8 to=move::to(m);
   const move::move_type mt=move::mt(m);
@@ -514,7 +562,7 @@ bool board::is_under_attack(const bool us,const u8 sq) const{
 }
 
 bool board::is_in_check() const{
-  return is_under_attack(side_to_move,ksq(side_to_move));
+  return st->king_attacinfo.check();
 }
 
 bitboard board::attackers_to(const u8 sq,const bitboard occupied) const{
@@ -527,77 +575,78 @@ bitboard board::attackers_to(const u8 sq,const bitboard occupied) const{
     attack::king_att[sq]&get_pieces(king);
 }
 
-template<i32 Pt> bitboard board::atts_by(const bool c){
-  if constexpr(Pt==pawn)
-    return c==white
-      ?attack::pawn_att_bb<white>(get_pieces(c,pawn))
-      :attack::pawn_att_bb<black>(get_pieces(c,pawn));
-  else if constexpr(Pt==knight){
-    bitboard attackers=get_pieces(c,knight);
-    bitboard threats{};
-    while(attackers) threats|=attack::knight_att[pop_lsb(attackers)];
-    return threats;
-  } else if constexpr(Pt==bishop){
-    bitboard attackers=get_pieces(c,bishop);
-    bitboard threats{};
-    while(attackers) threats|=attack::atts<bishop>(pop_lsb(attackers),occupied());
-    return threats;
-  } else if constexpr(Pt==rook){
-    bitboard attackers=get_pieces(c,rook);
-    bitboard threats{};
-    while(attackers) threats|=attack::atts<rook>(pop_lsb(attackers),occupied());
-    return threats;
-  } else if constexpr(Pt==queen){
-    bitboard attackers=get_pieces(c,queen);
-    bitboard threats{};
-    while(attackers) threats|=attack::atts<queen>(pop_lsb(attackers),occupied());
-    return threats;
-  } else return {};
+bitboard board::attack_map(const bool c,const bitboard occupied) const{
+  bitboard atts=c==white
+    ?attack::pawn_att_bb<white>(get_pieces(c,pawn))
+    :attack::pawn_att_bb<black>(get_pieces(c,pawn));
+  bitboard attackers=get_pieces(c,knight);
+  while(attackers) atts|=attack::knight_att[pop_lsb(attackers)];
+  bitboard fills[attack::n_dirs];
+  attack::slider_fills(get_pieces(c,rook)|get_pieces(c,queen),get_pieces(c,bishop)|get_pieces(c,queen),~occupied,fills);
+  for(const auto& f:fills) atts|=f;
+  return atts|attack::king_att[ksq(c)];
 }
 
-bitboard board::least_valuable_piece(const bitboard attacking,
-  const bool attacker,i32& pc) const{
-  for(i32 pt=pawn;pt<=king;++pt){
-    if(const bitboard subset=attacking&get_pieces(pt)){
-      pc=pmake(attacker,pt);
-      return bitboard::from_sq(lsb(subset));
-    }
-  }
-  return {};
+threat_maps board::threats(const bool c) const{
+  const bool them=!c;
+  threat_maps t;
+  t.by_pawn=them==white
+    ?attack::pawn_att_bb<white>(get_pieces(them,pawn))
+    :attack::pawn_att_bb<black>(get_pieces(them,pawn));
+  bitboard knights=get_pieces(them,knight);
+  bitboard by_knight{};
+  while(knights) by_knight|=attack::knight_att[pop_lsb(knights)];
+  bitboard fills[attack::n_dirs];
+  attack::slider_fills(get_pieces(them,rook),get_pieces(them,bishop),~occupied(),fills);
+  bitboard by_bishop{};
+  bitboard by_rook{};
+  for(int d=0;d<attack::n_dirs;++d) (d&1?by_rook:by_bishop)|=fills[d];
+  t.by_minor=t.by_pawn|by_knight|by_bishop;
+  t.by_rook=t.by_minor|by_rook;
+  t.pieces=get_color(c)&
+    (t.by_pawn&(get_pieces(knight)|get_pieces(bishop))|
+      t.by_minor&get_pieces(rook)|
+      t.by_rook&get_pieces(queen));
+  return t;
 }
 
-int board::see(const u16 m) const{
-  if(move::mt(m)!=move::normal) return 0;
+bool board::see_ge(const u16 m,const int threshold) const{
+  const move::move_type mt=move::mt(m);
+  if(mt==move::castle) return threshold<=0;
   const u8 from=move::from(m);
   const u8 to=move::to(m);
-  i32 from_pc=piece_on(from);
-  const i32 to_pc=piece_on(to);
-  bool attacker=make(from_pc);
-  int gain[32],d=0;
-  bitboard from_set=bitboard::from_sq(from);
-  bitboard occ=occupied_bb;
-  bitboard attacking=attackers_to(to,occ);
-  gain[0]=eval::piece_values[to_pc];
+  bitboard occ=occupied_bb-bitboard::from_sq(from);
+  int swap=eval::piece_values[piece_on(to)]-threshold;
+  int victim=eval::piece_values[piece_on(from)];
+  if(mt==move::en_passant){
+    occ.clear(to-SCU8(pawn_push(side_to_move)));
+    swap+=eval::pt_values[pawn];
+  } else if(mt==move::promotion){
+    victim=eval::pt_values[move::get_piece_type(m)];
+    swap+=victim-eval::pt_values[pawn];
+  }
+  if(swap<0) return false;
+  swap=victim-swap;
+  if(swap<=0) return true;
+  const bitboard bishops=get_pieces(bishop)|get_pieces(queen);
+  const bitboard rooks=get_pieces(rook)|get_pieces(queen);
+  bitboard attackers=attackers_to(to,occ);
+  bool stm=side_to_move;
+  bool res=true;
   for(;;){
-    ++d;
-    attacker=!attacker;
-    gain[d]=eval::piece_values[from_pc]-gain[d-1];
-    if(std::max(-gain[d-1],gain[d])<0) break;
-    attacking^=from_set;
-    occ^=from_set;
-    attacking|=
-      occ&
-      (attack::atts<bishop>(to,occ)&(get_pieces(bishop)|get_pieces(queen))|
-        attack::atts<rook>(to,occ)&(get_pieces(rook)|get_pieces(queen)));
-    from_set=least_valuable_piece(attacking,attacker,from_pc);
-    if(!from_set) break;
+    stm=!stm;
+    attackers&=occ;
+    const bitboard stm_attackers=attackers&get_color(stm);
+    if(!stm_attackers) break;
+    res=!res;
+    i32 pt=pawn;
+    while(!(stm_attackers&get_pieces(pt))) ++pt;
+    if(pt==king) return attackers-get_color(stm)?!res:res;
+    swap=eval::pt_values[pt]-swap;
+    if(swap<SCI(res)) break;
+    occ.clear(lsb(stm_attackers&get_pieces(pt)));
+    if(pt==pawn||pt==bishop||pt==queen) attackers|=attack::atts<bishop>(to,occ)&bishops;
+    if(pt==rook||pt==queen) attackers|=attack::atts<rook>(to,occ)&rooks;
   }
-  while(--d) gain[d-1]=-std::max(-gain[d-1],gain[d]);
-  return gain[0];
+  return res;
 }
-
-template bitboard board::atts_by<pawn>(bool c);
-template bitboard board::atts_by<knight>(bool c);
-template bitboard board::atts_by<bishop>(bool c);
-template bitboard board::atts_by<rook>(bool c);
-template bitboard board::atts_by<queen>(bool c);
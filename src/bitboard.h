@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <bit>
 #include <chrono>
 #include <cstdint>
@@ -6,6 +7,7 @@
 #include <vector>
 #include <ostream>
 #include "main.h"
+#include "nnue.h"
 
 struct bitboard{
   u64 data;
@@ -209,16 +211,25 @@ struct castle{
 };
 
 struct king_attack_info{
-  bitboard pinned{};
+  bitboard checkers{};
   bitboard atts{};
+  bitboard pinned{};
+  bitboard discovered{};
+  bitboard check_sqs[n_piece_types]{};
   bool double_check=false;
-  bool computed=false;
 
   [[nodiscard]] bool check() const{
-    return SCB(atts);
+    return SCB(checkers);
   }
 };
 
+struct threat_maps{
+  bitboard by_pawn;
+  bitboard by_minor;
+  bitboard by_rook;
+  bitboard pieces;
+};
+
 struct board_state{
   castle castles{};
   int fifty_move_count=0;
@@ -229,23 +240,23 @@ struct board_state{
   u16 move=0;
   i32 captured=0;
   u8 ep_sq=0;
+  nnue_data nnue;
 };
 
+inline constexpr int max_history=128;
+inline constexpr int max_states=max_history+max_ply+2;
+
 struct board{
   ~board() = default;
   bitboard color_bb[n_colors]{};
-  bitboard least_valuable_piece(bitboard attacking,bool attacker,i32& pc) const;
   bitboard occupied_bb{};
   bitboard piece_bb[n_piece_types]{};
   board_state* bs(int idx);
-  board_state* get_board_status();
   board_state* st=nullptr;
 
   board() = default;
-  board(board&& other) noexcept = default;
   board(const board& other);
 
-  board& operator=(board&& other) noexcept = default;
   board& operator=(const board& other);
 
   bool is_legal(u16 m);
@@ -255,20 +266,23 @@ struct board{
   friend std::ostream& operator<<(std::ostream& os,const board& pos);
   i32 pos[n_sqs]{};
   static bool is_promotion(u16 m);
-  std::vector<board_state> board_status{};
+  board_state states[max_states];
 
   template<bool UpdateZobrist=true> void move_piece(u8 from,u8 to);
   template<bool UpdateZobrist=true> void remove_piece(u8 sq);
   template<bool UpdateZobrist=true> void set_piece(i32 pc,u8 sq);
-  template<i32 Pt> bitboard atts_by(bool c);
 
   void apply_move(u16 m);
   void apply_null_move();
+  void set(const std::string& fen);
   void gen_king_attack_info(king_attack_info& k) const;
+  void trim_history();
   void undo_move();
   void undo_null_move();
 
+  [[nodiscard]] bitboard attack_map(bool c,bitboard occupied) const;
   [[nodiscard]] bitboard attackers_to(u8 sq,bitboard occupied) const;
+  [[nodiscard]] threat_maps threats(bool c) const;
   [[nodiscard]] bitboard get_color(bool c) const;
   [[nodiscard]] bitboard get_pieces(bool c,i32 pt) const;
   [[nodiscard]] bitboard get_pieces(i32 pt) const;
@@ -282,10 +296,13 @@ struct board{
   [[nodiscard]] bool is_in_check() const;
   [[nodiscard]] bool is_pseudo_legal(u16 m) const;
   [[nodiscard]] bool is_under_attack(bool us,u8 sq) const;
+  [[nodiscard]] bool see_ge(u16 m,int threshold) const;
   [[nodiscard]] i32 piece_on(u8 sq) const;
-  [[nodiscard]] int see(u16 m) const;
+  [[nodiscard]] int history_size() const;
+  [[nodiscard]] int recent_states() const;
   [[nodiscard]] std::string fen() const;
   [[nodiscard]] u64 key() const;
+  [[nodiscard]] u64 key_after(u16 m) const;
   [[nodiscard]] u8 ksq(bool c) const;
 };
 
@@ -293,12 +310,16 @@ inline i32 board::piece_on(const u8 sq) const{
   return pos[sq];
 }
 
-inline board_state* board::get_board_status(){
-  return &board_status.back();
+inline board_state* board::bs(const int idx){
+  return st-idx;
 }
 
-inline board_state* board::bs(const int idx){
-  return &board_status[board_status.size()-idx-1];
+inline int board::history_size() const{
+  return SCI(st-states)+1;
+}
+
+inline int board::recent_states() const{
+  return std::min({history_size(),st->fifty_move_count+1,max_history});
 }
 
 inline bool board::can_castle(const int cr) const{
@@ -385,9 +406,3 @@ inline u8 pop_lsb(bitboard& b){
 inline u8 board::ksq(const bool c) const{
   return lsb(get_pieces(c,king));
 }
-
-extern template bitboard board::atts_by<pawn>(bool c);
-extern template bitboard board::atts_by<knight>(bool c);
-extern template bitboard board::atts_by<bishop>(bool c);
-extern template bitboard board::atts_by<rook>(bool c);
-extern template bitboard board::atts_by<queen>(bool c);
@@ -43,10 +43,9 @@ void chrono::init_time(const bool side_to_move){
   }
 }
 
-void chrono::update(const u64 node_cnt){
-  if(use_match_limit&&elapsed()>time_to_use||
-    use_node_limit&&node_cnt>node_limit||
-    use_move_limit&&elapsed()>move_time_limit){
-    stop=true;
-  }
+time_point chrono::hard_limit() const{
+  time_point limit=std::numeric_limits<time_point>::max();
+  if(use_match_limit) limit=time_to_use;
+  if(use_move_limit) limit=std::min(limit,move_time_limit);
+  return limit;
 }
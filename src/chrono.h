@@ -3,7 +3,6 @@
 #include "main.h"
 
 struct chrono{
-  bool stop;
   bool use_depth_limit;
   bool use_match_limit;
   bool use_move_limit;
@@ -18,10 +17,10 @@ struct chrono{
   time_point time_to_use;
   time_point time[n_colors],inc[n_colors];
   [[nodiscard]] time_point elapsed() const;
+  [[nodiscard]] time_point hard_limit() const;
   static time_point now();
   u64 node_limit;
 
   void init_time(bool side_to_move);
   void start();
-  void update(u64 node_cnt);
 };
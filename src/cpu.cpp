@@ -0,0 +1,56 @@
+#include "cpu.h"
+
+#if defined(__GNUC__)
+#include <cpuid.h>
+#else
+#include <intrin.h>
+#endif
+
+namespace cpu{
+  namespace{
+    void cpuid(const unsigned leaf,const unsigned subleaf,unsigned regs[4]){
+#if defined(__GNUC__)
+      __cpuid_count(leaf,subleaf,regs[0],regs[1],regs[2],regs[3]);
+#else
+      int r[4];
+      __cpuidex(r,SCI(leaf),SCI(subleaf));
+      for(int i=0;i<4;i++) regs[i]=SC<unsigned>(r[i]);
+#endif
+    }
+
+    u64 xgetbv0(){
+#if defined(__GNUC__)
+      unsigned lo,hi;
+      __asm__ volatile("xgetbv" : "=a"(lo),"=d"(hi) : "c"(0));
+      return SCU64(hi)<<32|lo;
+#else
+      return _xgetbv(0);
+#endif
+    }
+
+    features probe(){
+      features f;
+      unsigned regs[4];
+      cpuid(0,0,regs);
+      const unsigned max_leaf=regs[0];
+      cpuid(1,0,regs);
+      f.sse41=regs[2]&1u<<19;
+      const bool osxsave=regs[2]&1u<<27;
+      const bool avx=regs[2]&1u<<28;
+      if(max_leaf<7) return f;
+      cpuid(7,0,regs);
+      f.bmi2=regs[1]&1u<<8;
+      if(!osxsave||!avx) return f;
+      const u64 xcr0=xgetbv0();
+      if((xcr0&0x6)!=0x6) return f;
+      f.avx2=regs[1]&1u<<5;
+      f.avx512_vnni=f.avx2&&regs[1]&1u<<16&&regs[1]&1u<<30&&regs[1]&1u<<31&&regs[2]&1u<<11&&(xcr0&0xe0)==0xe0;
+      return f;
+    }
+  }
+
+  const features& detect(){
+    static const features f=probe();
+    return f;
+  }
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "main.h"
+
+namespace cpu{
+  struct features{
+    bool sse41=false;
+    bool avx2=false;
+    bool avx512_vnni=false;
+    bool bmi2=false;
+  };
+
+  const features& detect();
+}
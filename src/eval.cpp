@@ -4,6 +4,7 @@
 #include "eval.h"
 #include "attack.h"
 #include "nnue.h"
+#include "stats.h"
 #include "uci.h"
 
 namespace eval{ namespace{
@@ -62,8 +63,7 @@ namespace eval{ namespace{
       else if(shield_count==2) safety_score+=5;
       else if(shield_count==1) safety_score-=10;
       else safety_score-=40;
-      const bitboard occupied=pos.occupied();
-      const bitboard threats=pos.attackers_to(king_sq,occupied)&~pos.get_color(us);
+      const bitboard threats=us==pos.side_to_move?pos.st->king_attacinfo.checkers:bitboard{};
       safety_score-=10*popcnt(threats);
       if(threats&pos.get_pieces(queen)) safety_score-=10;
       if(threats&pos.get_pieces(rook)) safety_score-=6;
@@ -120,48 +120,35 @@ namespace eval{ namespace{
   }
 
   namespace{
-    constexpr std::array piece_map={
-    0,6,5,4,3,2,1,0,
-    0,12,11,10,9,8,7,0
-    };
-
-    int nnue_evaluate(const int player,int* pieces,int* squares){
-      nnue_data nnue;
-      nnue.accumulator.computed_accumulation=0;
-      nnboard pos{};
-      pos.nnue[0]=&nnue;
-      pos.nnue[1]=nullptr;
-      pos.nnue[2]=nullptr;
-      pos.player=player;
-      pos.pieces=pieces;
-      pos.squares=squares;
-      return nnue::evaluate_pos(&pos);
-    }
-
     int evaluate_nnue(const board& pos){
       std::array<int,33> pieces{};
       std::array<int,33> squares{};
+      pieces[0]=wking;
+      squares[0]=pos.ksq(white);
+      pieces[1]=bking;
+      squares[1]=pos.ksq(black);
       int index=2;
-      for(uint8_t sq=0;sq<64;++sq){
-        const int piece=pos.piece_on(sq);
-        if(const int mapped=piece_map[piece];mapped==1){
-          pieces[0]=1;
-          squares[0]=sq;
-        } else if(mapped==7){
-          pieces[1]=7;
-          squares[1]=sq;
-        } else if(mapped!=0){
-          pieces[index]=mapped;
-          squares[index]=sq;
-          ++index;
-        }
+      bitboard occ=pos.occupied()-pos.get_pieces(king);
+      while(occ){
+        const u8 sq=pop_lsb(occ);
+        pieces[index]=piece_map[pos.piece_on(sq)];
+        squares[index]=sq;
+        ++index;
       }
-      const int nnue_score=nnue_evaluate(pos.side_to_move,pieces.data(),squares.data());
-      return nnue_score;
+      const int depth=pos.history_size();
+      nnboard nnpos{};
+      nnpos.nnue[0]=&pos.st->nnue;
+      nnpos.nnue[1]=depth>1?&(pos.st-1)->nnue:nullptr;
+      nnpos.nnue[2]=depth>2?&(pos.st-2)->nnue:nullptr;
+      nnpos.player=pos.side_to_move;
+      nnpos.pieces=pieces.data();
+      nnpos.squares=squares.data();
+      return nnue::evaluate_pos(&nnpos);
     }
   }
 
   int evaluate(const board& pos){
+    STAT(evals);
     if(uci::use_nnue) return evaluate_nnue(pos);
     return hce(pos);
   }
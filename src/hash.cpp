@@ -1,11 +1,30 @@
 #include "hash.h"
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
-#include <memory>
+#include <new>
 #include "main.h"
+#include "stats.h"
+
+#ifdef _WIN64
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#endif
+
+hash_table::~hash_table(){
+  free_table();
+}
 
 void hash_table::set_size(const u64 mb){
   const u64 bytes=mb*1024*1024;
-  const u64 max_size=bytes/sizeof(hash_entry);
+  const u64 max_size=bytes/sizeof(hash_cluster);
   size=1;
   for(;;){
     const u64 new_size=2*size;
@@ -13,34 +32,170 @@ void hash_table::set_size(const u64 mb){
     size=new_size;
   }
   mask=size-1;
-  entries=std::make_unique<hash_entry[]>(size);
-  clear();
+  size_mb=mb;
+  allocate(size*sizeof(hash_cluster));
 }
 
-void hash_table::clear() const{
-  std::memset(entries.get(),0,size*sizeof(hash_entry));
+void hash_table::allocate(const u64 bytes){
+  free_table();
+  alloc_bytes=(bytes+huge_page_size-1)/huge_page_size*huge_page_size;
+  void* mem=nullptr;
+#ifdef _WIN64
+  if(const SIZE_T large_page=GetLargePageMinimum();use_large_pages&&large_page){
+    const u64 large_bytes=(alloc_bytes+large_page-1)/large_page*large_page;
+    mem=VirtualAlloc(nullptr,large_bytes,MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES,PAGE_READWRITE);
+    if(mem){
+      alloc_bytes=large_bytes;
+      pages=large_pages;
+    }
+  }
+  if(!mem){
+    mem=VirtualAlloc(nullptr,alloc_bytes,MEM_RESERVE|MEM_COMMIT,PAGE_READWRITE);
+    pages=small_pages;
+  }
+#else
+#ifdef MAP_HUGETLB
+  if(use_large_pages){
+    mem=mmap(nullptr,alloc_bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+    if(mem==MAP_FAILED) mem=nullptr;
+    else pages=large_pages;
+  }
+#endif
+  if(!mem){
+    mem=std::aligned_alloc(huge_page_size,alloc_bytes);
+    pages=small_pages;
+#ifdef MADV_HUGEPAGE
+    if(mem&&!madvise(mem,alloc_bytes,MADV_HUGEPAGE)) pages=transparent_pages;
+#endif
+  }
+#endif
+  if(!mem){
+    alloc_bytes=0;
+    throw std::bad_alloc();
+  }
+  clusters=SC<hash_cluster*>(mem);
+}
+
+void hash_table::free_table(){
+  if(!clusters) return;
+#ifdef _WIN64
+  VirtualFree(clusters,0,MEM_RELEASE);
+#else
+  if(pages==large_pages) munmap(clusters,alloc_bytes);
+  else std::free(clusters);
+#endif
+  clusters=nullptr;
+}
+
+u64 hash_table::huge_page_bytes() const{
+  if(pages==large_pages) return alloc_bytes;
+#if defined(__linux__)
+  if(pages!=transparent_pages) return 0;
+  const auto begin=reinterpret_cast<uintptr_t>(clusters);
+  const auto end=begin+alloc_bytes;
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line,field;
+  bool in_table=false;
+  u64 total=0;
+  while(std::getline(smaps,line)){
+    std::istringstream ss(line);
+    ss>>field;
+    if(field.empty()) continue;
+    if(field.back()!=':'){
+      const size_t dash=field.find('-');
+      if(dash==std::string::npos) continue;
+      const uintptr_t lo=std::stoull(field.substr(0,dash),nullptr,16);
+      const uintptr_t hi=std::stoull(field.substr(dash+1),nullptr,16);
+      in_table=lo<end&&hi>begin;
+    } else if(in_table&&field=="AnonHugePages:"){
+      u64 kb=0;
+      ss>>kb;
+      total+=kb*1024;
+    }
+  }
+  return std::min(total,alloc_bytes);
+#else
+  return 0;
+#endif
+}
+
+void hash_table::clear_slice(const thread_id idx,const thread_id count){
+  const u64 bytes=size*sizeof(hash_cluster);
+  const u64 pages_total=(bytes+huge_page_size-1)/huge_page_size;
+  const u64 slice=(pages_total+count-1)/count*huge_page_size;
+  const u64 begin=idx*slice;
+  if(begin>=bytes) return;
+  std::memset(reinterpret_cast<char*>(clusters)+begin,0,std::min(slice,bytes-begin));
+}
+
+int hash_table::hashfull() const{
+  const u64 samples=std::min(hashfull_samples,size);
+  u64 cnt=0;
+  for(u64 i=0;i<samples;++i){
+    for(const hash_entry& e:clusters[i].entry)
+      cnt+=e.nt()!=none_node&&(e.gen_bound&gen_mask)==generation;
+  }
+  return SCI(cnt*1000/(samples*cluster_size));
+}
+
+hash_usage hash_table::usage() const{
+  hash_usage u;
+  for(u64 i=0;i<size;++i){
+    for(const hash_entry& e:clusters[i].entry){
+      ++u.entries;
+      if(e.nt()==none_node) continue;
+      ++u.used;
+      ++u.by_bound[e.nt()];
+      ++u.by_age[relative_age(e)/gen_delta];
+      ++u.by_depth[e.depth];
+    }
+  }
+  return u;
+}
+
+void hash_table::new_search(){
+  generation+=gen_delta;
 }
 
 bool hash_table::probe(const u64 key,hash_entry& entry){
-  entry=*get(key);
-  if((entry.key^entry.data_union.data)==key) return true;
+  const u16 key16=SCU16(key>>48);
+  STAT(tt_probes);
+  for(hash_entry& e:get(key)->entry){
+    if(e.key==key16&&e.nt()!=none_node){
+      STAT(tt_hits);
+      e.gen_bound=SCU8(generation|e.nt());
+      entry=e;
+      return true;
+    }
+  }
   entry={};
   return false;
 }
 
 void hash_table::save(const u64 key,const int score,const int static_eval,const u16 move,
   const i32 depth,const node_type nt){
-  hash_entry tmp;
-  tmp.data_union.entry_data.score=score;
-  tmp.data_union.entry_data.eval=static_eval;
-  tmp.data_union.entry_data.move=move;
-  tmp.data_union.entry_data.depth=SCU8(depth);
-  tmp.data_union.entry_data.nt=nt;
-  tmp.key=key^tmp.data_union.data;
-  if(hash_entry* entry=get(key);nt==pvnode||
-    key!=(entry->key^entry->data_union.data)||
-    depth+4>entry->data_union.entry_data.depth){
-    *entry=tmp;
+  const u16 key16=SCU16(key>>48);
+  hash_entry* cluster=get(key)->entry;
+  hash_entry* replace=cluster;
+  for(int i=0;i<cluster_size;++i){
+    if(cluster[i].nt()==none_node||cluster[i].key==key16){
+      replace=&cluster[i];
+      break;
+    }
+    if(replace->depth-2*relative_age(*replace)>
+      cluster[i].depth-2*relative_age(cluster[i]))
+      replace=&cluster[i];
+  }
+  if(move||replace->key!=key16) replace->move=move;
+  if(nt==pvnode||replace->key!=key16||
+    depth+4>replace->depth||relative_age(*replace)){
+    STAT(tt_writes);
+    if(replace->nt()!=none_node&&replace->key!=key16) STAT(tt_overwrites);
+    replace->key=key16;
+    replace->score=SC<i16>(score);
+    replace->eval=SC<i16>(static_eval);
+    replace->depth=SCU8(depth);
+    replace->gen_bound=SCU8(generation|nt);
   }
 }
 
@@ -1,41 +1,94 @@
 #pragma once
-#include <memory>
 #include "main.h"
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
 
 enum node : u8{
   none_node,pvnode,cutnode,allnode
 };
 
 struct hash_entry{
-  u64 key;
-
-  union data_union{
-    struct entry_data{
-      i32 depth;
-      int eval;
-      int score;
-      node_type nt;
-      u16 move;
-    } entry_data;
-
-    u64 data;
-  } data_union;
+  u16 key;
+  u16 move;
+  i16 score;
+  i16 eval;
+  u8 depth;
+  u8 gen_bound;
+
+  [[nodiscard]] node_type nt() const{
+    return gen_bound&0x3;
+  }
+};
+
+constexpr int cluster_size=3;
+
+struct alignas(32) hash_cluster{
+  hash_entry entry[cluster_size];
+  char padding[2];
 };
 
+static_assert(sizeof(hash_cluster)==32);
+
 constexpr size_t max_hash_size=1<<20;
+constexpr u64 hashfull_samples=1000;
+constexpr u64 huge_page_size=2*1024*1024;
+
+enum page_kind : u8{
+  small_pages,transparent_pages,large_pages
+};
+
+struct hash_usage{
+  u64 entries=0;
+  u64 used=0;
+  u64 by_bound[4]{};
+  u64 by_age[256/4]{};
+  u64 by_depth[256]{};
+};
 
 struct hash_table{
-  hash_entry* get(const u64 key){
-    return &entries[key&mask];
+  hash_table()=default;
+  hash_table(const hash_table&)=delete;
+  hash_table& operator=(const hash_table&)=delete;
+  ~hash_table();
+  static constexpr u8 gen_delta=1<<2;
+  static constexpr int gen_cycle=255+gen_delta;
+  static constexpr u8 gen_mask=SCU8(0xff<<2);
+
+  hash_cluster* get(const u64 key){
+    return &clusters[key&mask];
+  }
+
+  void prefetch(const u64 key) const{
+#if defined(_MSC_VER)
+    _mm_prefetch(reinterpret_cast<const char*>(&clusters[key&mask]),_MM_HINT_T0);
+#else
+    __builtin_prefetch(&clusters[key&mask]);
+#endif
+  }
+
+  [[nodiscard]] int relative_age(const hash_entry& e) const{
+    return (gen_cycle+generation-e.gen_bound)&gen_mask;
   }
 
+  [[nodiscard]] hash_usage usage() const;
+  [[nodiscard]] int hashfull() const;
+  [[nodiscard]] u64 huge_page_bytes() const;
   bool probe(u64 key,hash_entry& entry);
+  bool use_large_pages=false;
+  hash_cluster* clusters=nullptr;
+  page_kind pages=small_pages;
   static int score_from_hash(int score,i32 ply);
   static int score_to_hash(int score,i32 ply);
-  std::unique_ptr<hash_entry[]> entries;
+  u64 alloc_bytes=0;
   u64 mask=0;
   u64 size=0;
-  void clear() const;
+  u64 size_mb=0;
+  u8 generation=0;
+  void allocate(u64 bytes);
+  void clear_slice(thread_id idx,thread_id count);
+  void free_table();
+  void new_search();
   void save(u64 key,int score,int static_eval,u16 move,i32 depth,
     node_type nt);
   void set_size(u64 mb);
@@ -45,6 +45,7 @@ using std::chrono::milliseconds;
 using std::log;
 using time_point=milliseconds::rep;
 
+inline constexpr int cache_line=64;
 inline constexpr int max_depth=256;
 inline constexpr int max_ply=256;
 
@@ -179,25 +180,27 @@ inline u32 rand_u32(const u32 low,const u32 high){
   return dis(gen);
 }
 
-inline u64 rand_u64(){
-  std::random_device rd;
-  std::mt19937_64 gen(rd());
-  std::uniform_int_distribution<u64> dis;
-  return dis(gen);
+inline u64 rand_u64(u64& seed){
+  u64 z=seed+=0x9e3779b97f4a7c15;
+  z=(z^z>>30)*0xbf58476d1ce4e5b9;
+  z=(z^z>>27)*0x94d049bb133111eb;
+  return z^z>>31;
 }
 
 namespace zobrist{
+  constexpr u64 seed=0x6b6f627261;
   inline u64 psq[16][n_sqs];
   inline u64 side;
   inline u64 castle[16];
   inline u64 en_passant[n_files];
 
   inline void init(){
+    u64 s=seed;
     for(auto& i:psq){
-      for(u64& j:i) j=rand_u64();
+      for(u64& j:i) j=rand_u64(s);
     }
-    side=rand_u64();
-    for(u64& i:castle) i=rand_u64();
-    for(u64& i:en_passant) i=rand_u64();
+    side=rand_u64(s);
+    for(u64& i:castle) i=rand_u64(s);
+    for(u64& i:en_passant) i=rand_u64(s);
   }
 }
@@ -1,8 +1,31 @@
 #include "movegen.h"
-#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include "attack.h"
 
-template<bool C> void gen_pawn_moves(board& pos,move_list& movelist){
+inline bool pin_safe(const board& pos,const u8 from,const u8 to){
+  return !pos.st->king_attacinfo.pinned.is_set(from)||
+    attack::line_bb[pos.ksq(pos.side_to_move)][from].is_set(to);
+}
+
+template<bool C> bool ep_legal(const board& pos,const u8 from,const u8 to,const bitboard check_mask){
+  const u8 capsq=to-SCU8(pawn_push(C));
+  if(!check_mask.is_set(to)&&!check_mask.is_set(capsq)) return false;
+  const u8 ksq=pos.ksq(C);
+  const bitboard occ=pos.occupied()^bitboard::from_sq(from)^bitboard::from_sq(capsq)|bitboard::from_sq(to);
+  return !(attack::atts<rook>(ksq,occ)&(pos.get_pieces(!C,rook)|pos.get_pieces(!C,queen)))&&
+    !(attack::atts<bishop>(ksq,occ)&(pos.get_pieces(!C,bishop)|pos.get_pieces(!C,queen)));
+}
+
+template<gen_type Gt> void add_promotions(move_list& movelist,const u8 from,const u8 to,const bool capture){
+  if constexpr(Gt!=quiets) movelist.add(move::make<queen>(from,to));
+  if(Gt==captures&&!capture) return;
+  movelist.add(move::make<knight>(from,to));
+  movelist.add(move::make<bishop>(from,to));
+  movelist.add(move::make<rook>(from,to));
+}
+
+template<bool C,gen_type Gt> void gen_pawn_moves(board& pos,move_list& movelist,const bitboard target,const bitboard check_mask){
   u8 from;
   u8 to;
   constexpr i32 up_left=C==white?northwest:southwest;
@@ -12,137 +35,200 @@ template<bool C> void gen_pawn_moves(board& pos,move_list& movelist){
   constexpr bool us=C;
   constexpr bitboard relative_rank4_bb=C==white?rank4:rank5;
   constexpr bitboard relative_rank8_bb=C==white?rank8:rank1;
-  bitboard empty=~pos.occupied();
+  const bitboard empty=~pos.occupied();
   const bitboard our_pawns=pos.get_pieces(us,pawn);
   const bitboard single_pawn_push_targets=our_pawns.shift<up>()&empty;
-  const bitboard their_team=pos.get_color(them);
+  const bitboard their_team=pos.get_color(them)&target;
   const bitboard up_left_bb=our_pawns.shift<up_left>();
   const bitboard up_left_captures=up_left_bb&their_team;
   const bitboard up_right_bb=our_pawns.shift<up_right>();
   const bitboard up_right_captures=up_right_bb&their_team;
-  bitboard atts=single_pawn_push_targets-relative_rank8_bb;
-  while(atts){
-    to=pop_lsb(atts);
-    from=to-SCU8(up);
-    movelist.add(move::make(from,to));
+  bitboard atts;
+  if constexpr(Gt!=captures){
+    atts=single_pawn_push_targets-relative_rank8_bb&target;
+    while(atts){
+      to=pop_lsb(atts);
+      from=to-SCU8(up);
+      if(pin_safe(pos,from,to)) movelist.add(move::make(from,to));
+    }
+    atts=single_pawn_push_targets.shift<up>()&empty&relative_rank4_bb&target;
+    while(atts){
+      to=pop_lsb(atts);
+      from=to-SCU8(2*up);
+      if(pin_safe(pos,from,to)) movelist.add(move::make(from,to));
+    }
   }
   atts=single_pawn_push_targets&relative_rank8_bb;
+  atts&=Gt==captures?check_mask:target;
   while(atts){
     to=pop_lsb(atts);
     from=to-SCU8(up);
-    movelist.add(move::make<knight>(from,to));
-    movelist.add(move::make<bishop>(from,to));
-    movelist.add(move::make<rook>(from,to));
-    movelist.add(move::make<queen>(from,to));
-  }
-  atts=single_pawn_push_targets.shift<up>()&empty&relative_rank4_bb;
-  while(atts){
-    to=pop_lsb(atts);
-    from=to-SCU8(2*up);
-    movelist.add(move::make(from,to));
-  }
-  atts=up_right_captures-relative_rank8_bb;
-  while(atts){
-    to=pop_lsb(atts);
-    from=to-SCU8(up_right);
-    movelist.add(move::make(from,to));
-  }
-  atts=up_left_captures-relative_rank8_bb;
-  while(atts){
-    to=pop_lsb(atts);
-    from=to-SCU8(up_left);
-    movelist.add(move::make(from,to));
-  }
-  atts=up_right_captures&relative_rank8_bb;
-  while(atts){
-    to=pop_lsb(atts);
-    from=to-SCU8(up_right);
-    movelist.add(move::make<knight>(from,to));
-    movelist.add(move::make<bishop>(from,to));
-    movelist.add(move::make<rook>(from,to));
-    movelist.add(move::make<queen>(from,to));
-  }
-  atts=up_left_captures&relative_rank8_bb;
-  while(atts){
-    to=pop_lsb(atts);
-    from=to-SCU8(up_left);
-    movelist.add(move::make<knight>(from,to));
-    movelist.add(move::make<bishop>(from,to));
-    movelist.add(move::make<rook>(from,to));
-    movelist.add(move::make<queen>(from,to));
+    if(pin_safe(pos,from,to)) add_promotions<Gt>(movelist,from,to,false);
   }
-  if(pos.st->ep_sq!=no_sq){
-    atts=up_right_bb&bitboard::from_sq(pos.st->ep_sq);
-    if(atts){
-      to=pos.st->ep_sq;
+  if constexpr(Gt!=quiets){
+    atts=up_right_captures-relative_rank8_bb;
+    while(atts){
+      to=pop_lsb(atts);
       from=to-SCU8(up_right);
-      movelist.add(make(from,to,move::en_passant));
+      if(pin_safe(pos,from,to)) movelist.add(move::make(from,to));
     }
-    atts=up_left_bb&bitboard::from_sq(pos.st->ep_sq);
-    if(atts){
-      to=pos.st->ep_sq;
+    atts=up_left_captures-relative_rank8_bb;
+    while(atts){
+      to=pop_lsb(atts);
       from=to-SCU8(up_left);
-      movelist.add(make(from,to,move::en_passant));
+      if(pin_safe(pos,from,to)) movelist.add(move::make(from,to));
+    }
+    atts=up_right_captures&relative_rank8_bb;
+    while(atts){
+      to=pop_lsb(atts);
+      from=to-SCU8(up_right);
+      if(pin_safe(pos,from,to)) add_promotions<Gt>(movelist,from,to,true);
+    }
+    atts=up_left_captures&relative_rank8_bb;
+    while(atts){
+      to=pop_lsb(atts);
+      from=to-SCU8(up_left);
+      if(pin_safe(pos,from,to)) add_promotions<Gt>(movelist,from,to,true);
+    }
+    if(pos.st->ep_sq!=no_sq){
+      atts=up_right_bb&bitboard::from_sq(pos.st->ep_sq);
+      if(atts){
+        to=pos.st->ep_sq;
+        from=to-SCU8(up_right);
+        if(ep_legal<C>(pos,from,to,check_mask)) movelist.add(make(from,to,move::en_passant));
+      }
+      atts=up_left_bb&bitboard::from_sq(pos.st->ep_sq);
+      if(atts){
+        to=pos.st->ep_sq;
+        from=to-SCU8(up_left);
+        if(ep_legal<C>(pos,from,to,check_mask)) movelist.add(make(from,to,move::en_passant));
+      }
     }
   }
 }
 
-template<bool C,i32 Pt> void gen_piece_moves(board& pos,move_list& movelist){
-  bitboard friendly=pos.get_color(C);
+template<bool C,i32 Pt> void gen_piece_moves(board& pos,move_list& movelist,const bitboard target){
+  const bitboard pinned=pos.st->king_attacinfo.pinned;
   bitboard get_pieces=pos.get_pieces(C,Pt);
+  if constexpr(Pt==knight) get_pieces-=pinned;
   while(get_pieces){
     u8 from=pop_lsb(get_pieces);
     bitboard atts=
       (Pt==knight
         ?attack::knight_att[from]
-        :attack::atts<Pt>(from,pos.occupied()))-
-      friendly;
+        :attack::atts<Pt>(from,pos.occupied()))&
+      target;
+    if(pinned.is_set(from)) atts&=attack::line_bb[pos.ksq(C)][from];
     while(atts) movelist.add(move::make(from,pop_lsb(atts)));
   }
 }
 
-template<bool C> void gen_king_moves(board& pos,move_list& movelist){
+template<bool C,gen_type Gt> void gen_king_moves(board& pos,move_list& movelist){
   const u8 ksq=pos.ksq(C);
-  bitboard atts=attack::king_att[ksq]-pos.get_color(C);
+  bitboard target=~pos.get_color(C);
+  if constexpr(Gt==captures) target=pos.get_color(!C);
+  else if constexpr(Gt==quiets) target=~pos.occupied();
+  bitboard atts=attack::king_att[ksq]&target;
+  const bool castling=(Gt==quiets||Gt==all_moves)&&ksq==relative(C,e1)&&
+    !pos.st->king_attacinfo.check()&&pos.can_castle(C==white?white_castle:black_castle);
+  if(!atts&&!castling) return;
+  const bitboard danger=pos.attack_map(!C,pos.occupied()-bitboard::from_sq(ksq));
+  atts-=danger;
   while(atts) movelist.add(move::make(ksq,pop_lsb(atts)));
-  if(ksq==relative(C,e1)){
+  if(castling){
     const bitboard empty=~pos.occupied();
     constexpr bitboard path1=
       C==white?white_qs_path:black_qs_path;
     constexpr bitboard path2=
       C==white?white_ks_path:black_ks_path;
+    constexpr bitboard king_path1=
+      bitboard::from_sq(relative(C,c1))|bitboard::from_sq(relative(C,d1));
+    constexpr bitboard king_path2=
+      bitboard::from_sq(relative(C,f1))|bitboard::from_sq(relative(C,g1));
     if(pos.can_castle(C==white?white_qs:black_qs)&&
-      (empty&path1)==path1)
+      (empty&path1)==path1&&!(danger&king_path1))
       movelist.add(make(ksq,relative(C,c1),move::castle));
     if(pos.can_castle(C==white?white_ks:black_ks)&&
-      (empty&path2)==path2)
+      (empty&path2)==path2&&!(danger&king_path2))
       movelist.add(make(ksq,relative(C,g1),move::castle));
   }
 }
 
-void gen_moves(board& pos,move_list& movelist){
-  if(!pos.st->king_attacinfo.computed) pos.gen_king_attack_info(pos.st->king_attacinfo);
-  movelist.last=movelist.data;
-  if(pos.side_to_move==white){
-    if(!pos.st->king_attacinfo.double_check){
-      gen_pawn_moves<white>(pos,movelist);
-      gen_piece_moves<white,knight>(pos,movelist);
-      gen_piece_moves<white,bishop>(pos,movelist);
-      gen_piece_moves<white,rook>(pos,movelist);
-      gen_piece_moves<white,queen>(pos,movelist);
-    }
-    gen_king_moves<white>(pos,movelist);
-  } else{
-    if(!pos.st->king_attacinfo.double_check){
-      gen_pawn_moves<black>(pos,movelist);
-      gen_piece_moves<black,knight>(pos,movelist);
-      gen_piece_moves<black,bishop>(pos,movelist);
-      gen_piece_moves<black,rook>(pos,movelist);
-      gen_piece_moves<black,queen>(pos,movelist);
-    }
-    gen_king_moves<black>(pos,movelist);
+template<bool C,gen_type Gt> void gen_color_moves(board& pos,move_list& movelist){
+  const king_attack_info& k=pos.st->king_attacinfo;
+  if(!k.double_check){
+    bitboard target=~pos.get_color(C);
+    if constexpr(Gt==captures) target=pos.get_color(!C);
+    else if constexpr(Gt==quiets) target=~pos.occupied();
+    const bitboard check_mask=k.check()?k.atts:~bitboard(0);
+    gen_pawn_moves<C,Gt>(pos,movelist,target&check_mask,check_mask);
+    gen_piece_moves<C,knight>(pos,movelist,target&check_mask);
+    gen_piece_moves<C,bishop>(pos,movelist,target&check_mask);
+    gen_piece_moves<C,rook>(pos,movelist,target&check_mask);
+    gen_piece_moves<C,queen>(pos,movelist,target&check_mask);
+  }
+  gen_king_moves<C,Gt>(pos,movelist);
+}
+
+template<gen_type Gt> void gen_moves(board& pos,move_list& movelist){
+  if(pos.side_to_move==white) gen_color_moves<white,Gt>(pos,movelist);
+  else gen_color_moves<black,Gt>(pos,movelist);
+}
+
+perft_table::perft_table(const size_t mb){
+  resize(mb);
+}
+
+void perft_table::clear(){
+  if(entries) std::memset(entries,0,(mask+1)*sizeof(perft_entry));
+}
+
+void perft_table::resize(const size_t mb){
+  std::free(entries);
+  u64 n=SCU64(mb)*1024*1024/sizeof(perft_entry);
+  n=n?std::bit_floor(n):1;
+  entries=SC<perft_entry*>(std::calloc(n,sizeof(perft_entry)));
+  mask=entries?n-1:0;
+}
+
+perft_table::~perft_table(){
+  std::free(entries);
+}
+
+bool perft_table::probe(const u64 key,const int depth,u64& nodes) const{
+  if(!entries) return false;
+  perft_entry& e=entries[key&mask];
+  const u64 data=std::atomic_ref(e.data).load(std::memory_order_relaxed);
+  if((std::atomic_ref(e.key).load(std::memory_order_relaxed)^data)!=key||SCI(data&0xff)!=depth) return false;
+  nodes=data>>8;
+  return true;
+}
+
+void perft_table::store(const u64 key,const int depth,const u64 nodes){
+  if(!entries) return;
+  perft_entry& e=entries[key&mask];
+  const u64 data=nodes<<8|SCU64(depth);
+  std::atomic_ref(e.key).store(key^data,std::memory_order_relaxed);
+  std::atomic_ref(e.data).store(data,std::memory_order_relaxed);
+}
+
+u64 perft(board& pos,const int depth,perft_table* tt){
+  if(depth<=0) return 1;
+  u64 nodes=0;
+  if(depth>1&&tt&&tt->probe(pos.key(),depth,nodes)) return nodes;
+  move_list moves;
+  gen_moves(pos,moves);
+  if(depth==1) return moves.size();
+  for(const auto& [move,score]:moves){
+    pos.apply_move(move);
+    nodes+=perft(pos,depth-1,tt);
+    pos.undo_move();
   }
-  movelist.last=std::ranges::remove_if(movelist,[&](const move_info& m){
-    return !pos.is_legal(m.move);
-  }).begin();
+  if(tt) tt->store(pos.key(),depth,nodes);
+  return nodes;
 }
+
+template void gen_moves<captures>(board& pos,move_list& movelist);
+template void gen_moves<quiets>(board& pos,move_list& movelist);
+template void gen_moves<evasions>(board& pos,move_list& movelist);
+template void gen_moves<all_moves>(board& pos,move_list& movelist);
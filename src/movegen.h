@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <cstring>
 #include <iostream>
 #include "bitboard.h"
@@ -53,34 +54,40 @@ inline void move_list::remove(const size_t idx){
   --last;
 }
 
-template<bool C> void gen_pawn_moves(board& pos,move_list& movelist);
-template<bool C,i32 Pt> void gen_piece_moves(board& pos,move_list& movelist);
-template<bool C> void gen_king_moves(board& pos,move_list& movelist);
-void gen_moves(board& pos,move_list& movelist);
-
-template<bool Root=true> u64 perft(board& pos,const int depth){
-  u64 cnt,nodes=0;
-  const bool leaf=depth==2;
-  move_list moves;
-  gen_moves(pos,moves);
-  for(size_t i=0;i<moves.size();++i){
-    if(Root&&depth<=1){
-      cnt=1;
-      ++nodes;
-    } else{
-      pos.apply_move(moves.move(i));
-      move_list m;
-      gen_moves(pos,m);
-      cnt=leaf?m.size():perft<false>(pos,depth-1);
-      nodes+=cnt;
-      pos.undo_move();
-    }
-    if(Root){
-      SO<<move::move_to_string(moves.move(i))<<" "<<cnt<<SE;
-    }
-  }
-  return nodes;
-}
+enum gen_type : u8{
+  captures,quiets,evasions,all_moves
+};
+
+template<bool C,gen_type Gt> void gen_pawn_moves(board& pos,move_list& movelist,bitboard target,bitboard check_mask);
+template<bool C,i32 Pt> void gen_piece_moves(board& pos,move_list& movelist,bitboard target);
+template<bool C,gen_type Gt> void gen_king_moves(board& pos,move_list& movelist);
+template<gen_type Gt=all_moves> void gen_moves(board& pos,move_list& movelist);
+
+struct perft_entry{
+  u64 key;
+  u64 data;
+};
+
+struct perft_table{
+  perft_table()=default;
+  explicit perft_table(size_t mb);
+  perft_table(const perft_table&)=delete;
+  perft_table& operator=(const perft_table&)=delete;
+  ~perft_table();
+  bool probe(u64 key,int depth,u64& nodes) const;
+  perft_entry* entries=nullptr;
+  u64 mask=0;
+  void clear();
+  void resize(size_t mb);
+  void store(u64 key,int depth,u64 nodes);
+};
+
+u64 perft(board& pos,int depth,perft_table* tt=nullptr);
+
+extern template void gen_moves<captures>(board& pos,move_list& movelist);
+extern template void gen_moves<quiets>(board& pos,move_list& movelist);
+extern template void gen_moves<evasions>(board& pos,move_list& movelist);
+extern template void gen_moves<all_moves>(board& pos,move_list& movelist);
 
 inline std::ostream& operator<<(std::ostream& os,const move_list& movelist){
   for(int i=0;i<SCI(movelist.size());++i) os<<move::move_to_string(movelist.move(i))<<" ";
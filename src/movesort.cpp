@@ -3,103 +3,195 @@
 #include "bitboard.h"
 #include "eval.h"
 #include "search.h"
+#include "stats.h"
 
 move_sort::move_sort(board& pos,search_stack* stack,history& hist,
-  const u16 move,const bool in_check) : position(pos),
+  const u16 move,const bool in_check,const i32 depth,const bool qsearch) : position(pos),
+captures_only(qsearch),
 is_in_check(in_check),
 hist(hist),
+depth(depth),
 idx{},
+end{},
+bad_end{},
+refutation_count{},
 stage(hashmove),
 ss(stack),
-hash_move(move){}
+hash_move(move),
+refutation{}{}
 
 u16 move_sort::next(){
   switch(stage){
-  case hashmove: ++stage;
+  case hashmove: stage=is_in_check?evasions_init:captures_only?qsearch_init:captures_init;
+    if(captures_only&&!is_in_check&&!position.is_capture(hash_move)&&
+      !(board::is_promotion(hash_move)&&move::get_piece_type(hash_move)==queen))
+      return next();
     if(position.is_pseudo_legal(hash_move)&&position.is_legal(hash_move)) return hash_move;
+    return next();
+  case captures_init: ++stage;
+    gen_moves<captures>(position,moves);
+    end=SCI(moves.size());
+    STAT_N(moves_generated,end);
+    score_captures(0,end);
     [[fallthrough]];
-  case normal_init: ++stage;
-    gen_moves(position,moves);
-    for(size_t i=0;i<moves.size();++i){
-      if(moves.move(i)==hash_move){
-        moves.remove(i);
-        break;
-      }
+  case good_captures: while(idx<end){
+      select_best(end);
+      if(moves.score(idx)<0) break;
+      if(const u16 m=moves.move(idx++);m!=hash_move) return m;
+    }
+    bad_end=end;
+    end=idx;
+    ++stage;
+    gen_refutations();
+    idx=0;
+    [[fallthrough]];
+  case refutations: if(idx<refutation_count) return refutation[idx++];
+    ++stage;
+    [[fallthrough]];
+  case quiets_init: ++stage;
+    idx=bad_end;
+    gen_moves<quiets>(position,moves);
+    STAT_N(moves_generated,SCI(moves.size())-idx);
+    score_quiets(idx,SCI(moves.size()));
+    partial_sort(idx,SCI(moves.size()),-quiet_sort_margin*depth);
+    [[fallthrough]];
+  case quiet_moves: while(SCSZ(idx)<moves.size()){
+      if(const u16 m=moves.move(idx++);m!=hash_move&&!is_refutation(m)) return m;
+    }
+    ++stage;
+    idx=end;
+    [[fallthrough]];
+  case bad_captures: while(idx<bad_end){
+      select_best(bad_end);
+      if(const u16 m=moves.move(idx++);m!=hash_move) return m;
     }
-    compute_scores();
-    std::ranges::sort(moves,[](const move_info& m1,const move_info& m2){
-      return m1.score>m2.score;
-    });
+    return u16();
+  case evasions_init: ++stage;
+    gen_moves<evasions>(position,moves);
+    end=SCI(moves.size());
+    STAT_N(moves_generated,end);
+    score_quiets(0,end);
+    for(int i=0;i<end;++i){
+      if(position.is_capture(moves.move(i))) moves.data[i].score=capture_score(moves.move(i));
+    }
+    [[fallthrough]];
+  case evasion_moves: while(idx<end){
+      select_best(end);
+      if(const u16 m=moves.move(idx++);m!=hash_move) return m;
+    }
+    return u16();
+  case qsearch_init: ++stage;
+    gen_moves<captures>(position,moves);
+    end=SCI(moves.size());
+    STAT_N(moves_generated,end);
+    score_captures(0,end);
     [[fallthrough]];
-  case normal: if(SCSZ(idx)==moves.size()) return u16();
-    return moves.move(idx++);
+  case qsearch_captures: while(idx<end){
+      select_best(end);
+      if(const u16 m=moves.move(idx++);m!=hash_move) return m;
+    }
+    return u16();
   default:;
   }
   return 0;
 }
 
-void move_sort::compute_scores(){
-  const bool us=position.side_to_move;
-  const bool them=!us;
-  const bitboard threatened_by_pawn=position.atts_by<pawn>(them);
-  const bitboard threatened_by_minor=threatened_by_pawn|
-    position.atts_by<knight>(them)|
-    position.atts_by<bishop>(them);
-  const bitboard threatened_by_rook=
-    threatened_by_minor|position.atts_by<rook>(them);
-  const bitboard threatened_pieces=
-    position.get_color(us)&
-    (threatened_by_pawn&(position.get_pieces(knight)|position.get_pieces(bishop))|
-      threatened_by_minor&position.get_pieces(rook)|
-      threatened_by_rook&position.get_pieces(queen));
-  for(auto& [move, score]:moves){
-    const u16 m=move;
+void move_sort::gen_refutations(){
+  const u16 candidates[]={
+    hist.killer[ss->ply][0],
+    hist.killer[ss->ply][1],
+    ss->ply>=2?hist.killer[ss->ply-2][0]:u16(),
+    hist.counter[(ss-1)->moved][move::to((ss-1)->move)]
+  };
+  for(const u16 m:candidates){
+    if(!m||m==hash_move||is_refutation(m)||position.is_capture(m)||
+      board::is_promotion(m)&&move::get_piece_type(m)==queen)
+      continue;
+    if(position.is_pseudo_legal(m)&&position.is_legal(m)) refutation[refutation_count++]=m;
+  }
+}
+
+bool move_sort::is_refutation(const u16 m) const{
+  for(int i=0;i<refutation_count;++i){
+    if(refutation[i]==m) return true;
+  }
+  return false;
+}
+
+void move_sort::select_best(const int last){
+  int best=idx;
+  for(int i=idx+1;i<last;++i){
+    if(moves.score(i)>moves.score(best)) best=i;
+  }
+  if(best!=idx) std::swap(moves.data[idx],moves.data[best]);
+}
+
+void move_sort::partial_sort(const int first,const int last,const int limit){
+  for(int sorted_end=first,p=first+1;p<last;++p){
+    if(moves.score(p)<limit) continue;
+    const move_info tmp=moves.data[p];
+    moves.data[p]=moves.data[++sorted_end];
+    int q=sorted_end;
+    for(;q>first&&moves.score(q-1)<tmp.score;--q) moves.data[q]=moves.data[q-1];
+    moves.data[q]=tmp;
+  }
+}
+
+int move_sort::capture_score(const u16 m) const{
+  if(!position.is_capture(m)) return 1000000+89*eval::pt_values[queen];
+  int s=position.see_ge(m,0)?1000000:-1000000;
+  const i32 moved=position.piece_on(move::from(m));
+  const u8 to=
+    move::mt(m)==move::en_passant
+    ?move::to(m)-
+    SCU8(pawn_push(position.side_to_move))
+    :move::to(m);
+  const i32 captured=ptmake(position.piece_on(to));
+  s+=89*eval::piece_values[position.piece_on(move::to(m))]+
+    hist.capture[moved][to][captured];
+  return s;
+}
+
+void move_sort::score_captures(const int first,const int last){
+  for(int i=first;i<last;++i) moves.data[i].score=capture_score(moves.move(i));
+}
+
+void move_sort::score_quiets(const int first,const int last){
+  const threat_maps threats=position.threats(position.side_to_move);
+  for(int i=first;i<last;++i){
+    const u16 m=moves.move(i);
     int s=0;
-    if(position.is_capture(m)){
-      const int see=position.see(m);
-      s+=see>=0?1000000:-1000000;
-      const i32 moved=position.piece_on(move::from(m));
-      const u8 to=
-        move::mt(m)==move::en_passant
-        ?move::to(m)-
-        SCU8(pawn_push(position.side_to_move))
-        :move::to(m);
-      const i32 captured=ptmake(position.piece_on(to));
-      s+=89*eval::piece_values[position.piece_on(move::to(m))]+
-        hist.capture[moved][to][captured];
-    } else{
-      if(m==hist.killer[ss->ply][0]) s+=500004;
-      else if(m==hist.killer[ss->ply][1]) s+=500003;
-      else if(ss->ply>=2&&m==hist.killer[ss->ply-2][0]) s+=500002;
+    if(m==hist.killer[ss->ply][0]) s+=500004;
+    else if(m==hist.killer[ss->ply][1]) s+=500003;
+    else if(ss->ply>=2&&m==hist.killer[ss->ply-2][0]) s+=500002;
+    else{
+      if(m==hist.counter[(ss-1)->moved][move::to((ss-1)->move)]) s+=500001;
       else{
-        if(m==hist.counter[(ss-1)->moved][move::to((ss-1)->move)]) s+=500001;
-        else{
-          const u8 from=move::from(m);
-          const u8 to=move::to(m);
-          s+=hist.butterfly[position.side_to_move][from][to]/155+
-            hist.continuation[(ss-1)->moved][move::to((ss-1)->move)]
-            [position.piece_on(from)][to]/
-            52+
-            hist.continuation[(ss-2)->moved][move::to((ss-2)->move)]
-            [position.piece_on(from)][to]/
-            61+
-            hist.continuation[(ss-4)->moved][move::to((ss-4)->move)]
-            [position.piece_on(from)][to]/
-            64;
-          if(threatened_pieces.is_set(from)){
-            const i32 pt=ptmake(position.piece_on(from));
-            const bool is_safe=
-              (pt==knight||pt==bishop)&&!threatened_by_pawn.is_set(to)||
-              (pt==rook&&!threatened_by_minor.is_set(to))||
-              (pt==queen&&!threatened_by_rook.is_set(to));
-            if(is_safe){
-              s+=561;
-            }
+        const u8 from=move::from(m);
+        const u8 to=move::to(m);
+        s+=hist.butterfly[position.side_to_move][from][to]/155+
+          hist.continuation[(ss-1)->moved][move::to((ss-1)->move)]
+          [position.piece_on(from)][to]/
+          52+
+          hist.continuation[(ss-2)->moved][move::to((ss-2)->move)]
+          [position.piece_on(from)][to]/
+          61+
+          hist.continuation[(ss-4)->moved][move::to((ss-4)->move)]
+          [position.piece_on(from)][to]/
+          64;
+        if(threats.pieces.is_set(from)){
+          const i32 pt=ptmake(position.piece_on(from));
+          const bool is_safe=
+            (pt==knight||pt==bishop)&&!threats.by_pawn.is_set(to)||
+            (pt==rook&&!threats.by_minor.is_set(to))||
+            (pt==queen&&!threats.by_rook.is_set(to));
+          if(is_safe){
+            s+=561;
           }
         }
       }
     }
-    score=s;
+    moves.data[i].score=s;
   }
 }
 
@@ -65,19 +65,33 @@ struct history{
 
 struct move_sort{
   enum stages : u8{
-    hashmove,normal_init,normal
+    hashmove,captures_init,good_captures,refutations,quiets_init,quiet_moves,bad_captures,
+    evasions_init,evasion_moves,qsearch_init,qsearch_captures
   };
 
+  static constexpr int quiet_sort_margin=64;
   board& position;
+  bool captures_only;
   bool is_in_check;
   history& hist;
+  i32 depth;
   int idx;
+  int end;
+  int bad_end;
+  int refutation_count;
   int stage;
   move_list moves;
   search_stack* ss;
   u16 hash_move;
+  u16 refutation[4];
   u16 next();
-  void compute_scores();
+  [[nodiscard]] bool is_refutation(u16 m) const;
+  [[nodiscard]] int capture_score(u16 m) const;
+  void gen_refutations();
+  void score_captures(int first,int last);
+  void score_quiets(int first,int last);
+  void select_best(int last);
+  void partial_sort(int first,int last,int limit);
   move_sort(board& pos,search_stack* stack,history& hist,u16 move,
-    bool in_check);
+    bool in_check,i32 depth,bool qsearch=false);
 };
@@ -1,29 +1,58 @@
 #include "nnue.h"
+#include <algorithm>
+#include <immintrin.h>
 #include "bitboard.h"
+#include "cpu.h"
 #include "main.h"
+#include "stats.h"
 
-void nnue::refresh_accumulator(const nnboard* pos){
-  accu* accumulator=&pos->nnue[0]->accumulator;
-  index_list active_indices[2];
-  active_indices[0].size=active_indices[1].size=0;
-  append_active_indices(pos,active_indices);
-  for(unsigned c=0;c<2;c++){
-    for(unsigned i=0;i<k_half_dimensions/(num_regs*simd_width/16);i++){
-      const vec16_t* ft_biases_tile=
-        reinterpret_cast<vec16_t*>(&ft_biases[i*(num_regs*simd_width/16)]);
-      const auto acc_tile=reinterpret_cast<vec16_t*>(
-        &accumulator->accumulation[c][i*(num_regs*simd_width/16)]);
-      vec16_t acc[num_regs];
-      for(unsigned j=0;j<num_regs;j++) acc[j]=ft_biases_tile[j];
-      for(size_t k=0;k<active_indices[c].size;k++){
-        const unsigned index=active_indices[c].values[k];
-        const unsigned offset=k_half_dimensions*index+i*(num_regs*simd_width/16);
-        const vec16_t* column=reinterpret_cast<vec16_t*>(&ft_weights[offset]);
-        for(unsigned j=0;j<num_regs;j++) acc[j]=_mm256_add_epi16(acc[j],column[j]);
+#if defined(__GNUC__)
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+namespace{
+  struct refresh_cache{
+    finny_entry entries[2][64];
+
+    refresh_cache(){
+      for(auto& perspective:entries){
+        for(auto& e:perspective){
+          memcpy(e.accumulation,ft_biases,sizeof(ft_biases));
+          memset(e.piece_bb,0,sizeof(e.piece_bb));
+        }
       }
-      for(unsigned j=0;j<num_regs;j++) acc_tile[j]=acc[j];
     }
+  };
+
+  thread_local refresh_cache finny;
+}
+
+void nnue::refresh_perspective(const nnboard* pos,const int color,int16_t* accumulation){
+  const int ksq=pos->squares[color];
+  finny_entry& entry=finny.entries[color][ksq];
+  uint64_t piece_bb[13]={};
+  for(int i=2;pos->pieces[i];i++) piece_bb[pos->pieces[i]]|=SCU64(1)<<pos->squares[i];
+  index_list removed,added;
+  removed.size=added.size=0;
+  const int oksq=orient(color,ksq);
+  for(int pc=wqueen;pc<=bpawn;pc++){
+    if(pc==bking) continue;
+    bitboard gone=entry.piece_bb[pc]&~piece_bb[pc];
+    bitboard came=piece_bb[pc]&~entry.piece_bb[pc];
+    while(gone) removed.values[removed.size++]=make_index(color,pop_lsb(gone),pc,oksq);
+    while(came) added.values[added.size++]=make_index(color,pop_lsb(came),pc,oksq);
+    entry.piece_bb[pc]=piece_bb[pc];
   }
+  update_columns(entry.accumulation,entry.accumulation,&removed,&added);
+  memcpy(accumulation,entry.accumulation,sizeof(entry.accumulation));
+}
+
+void nnue::refresh_accumulator(const nnboard* pos){
+  accu* accumulator=&pos->nnue[0]->accumulator;
+  STAT(nnue_refreshes);
+  for(int c=0;c<2;c++) refresh_perspective(pos,c,accumulator->accumulation[c]);
   accumulator->computed_accumulation=1;
 }
 
@@ -41,44 +70,19 @@ bool nnue::update_accumulator(const nnboard* pos){
   added_indices[0].size=added_indices[1].size=0;
   bool reset[2];
   append_changed_indices(pos,removed_indices,added_indices,reset);
-  for(unsigned i=0;i<k_half_dimensions/(num_regs*simd_width/16);i++){
-    for(unsigned c=0;c<2;c++){
-      const auto acc_tile=reinterpret_cast<vec16_t*>(
-        &accumulator->accumulation[c][i*(num_regs*simd_width/16)]);
-      vec16_t acc[num_regs];
-      if(reset[c]){
-        const vec16_t* ft_b_tile=
-          reinterpret_cast<vec16_t*>(&ft_biases[i*(num_regs*simd_width/16)]);
-        for(unsigned j=0;j<num_regs;j++) acc[j]=ft_b_tile[j];
-      } else{
-        const vec16_t* prev_acc_tile=reinterpret_cast<vec16_t*>(
-          &prev_acc->accumulation[c][i*(num_regs*simd_width/16)]);
-        for(unsigned j=0;j<num_regs;j++) acc[j]=prev_acc_tile[j];
-        for(unsigned k=0;k<removed_indices[c].size;k++){
-          const unsigned index=removed_indices[c].values[k];
-          const unsigned offset=k_half_dimensions*index+i*(num_regs*simd_width/16);
-          const vec16_t* column=
-            reinterpret_cast<vec16_t*>(&ft_weights[offset]);
-          for(unsigned j=0;j<num_regs;j++) acc[j]=_mm256_sub_epi16(acc[j],column[j]);
-        }
-      }
-      for(unsigned k=0;k<added_indices[c].size;k++){
-        const unsigned index=added_indices[c].values[k];
-        const unsigned offset=k_half_dimensions*index+i*(num_regs*simd_width/16);
-        const vec16_t* column=reinterpret_cast<vec16_t*>(&ft_weights[offset]);
-        for(unsigned j=0;j<num_regs;j++) acc[j]=_mm256_add_epi16(acc[j],column[j]);
-      }
-      for(unsigned j=0;j<num_regs;j++) acc_tile[j]=acc[j];
+  for(unsigned c=0;c<2;c++){
+    if(reset[c]){
+      refresh_perspective(pos,c,accumulator->accumulation[c]);
+      continue;
     }
+    update_columns(prev_acc->accumulation[c],accumulator->accumulation[c],
+      &removed_indices[c],&added_indices[c]);
   }
   accumulator->computed_accumulation=1;
+  STAT(nnue_updates);
   return true;
 }
 
-inline void nnue::append_active_indices(const nnboard* pos,index_list active[2]){
-  for(int c=0;c<2;c++) half_kp_append_active_indices(pos,c,&active[c]);
-}
-
 inline void nnue::append_changed_indices(
   const nnboard* pos,
   index_list removed[2],
@@ -88,17 +92,15 @@ inline void nnue::append_changed_indices(
   const dirty_piece* dp=&pos->nnue[0]->dirty_piece;
   if(pos->nnue[1]&&pos->nnue[1]->accumulator.computed_accumulation){
     for(int c=0;c<2;c++){
-      reset[c]=dp->pc[0]==SCI(c==0?black_king:white_king);
-      if(reset[c]) half_kp_append_active_indices(pos,c,&added[c]);
-      else half_kp_append_changed_indices(pos,c,dp,&removed[c],&added[c]);
+      reset[c]=dp->pc[0]==SCI(c==0?wking:bking);
+      if(!reset[c]) half_kp_append_changed_indices(pos,c,dp,&removed[c],&added[c]);
     }
   } else{
     const dirty_piece* dp2=&pos->nnue[1]->dirty_piece;
     for(int c=0;c<2;c++){
-      const int match_piece=c==0?SCI(black):SCI(white_king);
+      const int match_piece=c==0?SCI(wking):SCI(bking);
       reset[c]=dp->pc[0]==match_piece||dp2->pc[0]==match_piece;
-      if(reset[c]) half_kp_append_active_indices(pos,c,&added[c]);
-      else{
+      if(!reset[c]){
         half_kp_append_changed_indices(pos,c,dp,&removed[c],&added[c]);
         half_kp_append_changed_indices(pos,c,dp2,&removed[c],&added[c]);
       }
@@ -106,15 +108,6 @@ inline void nnue::append_changed_indices(
   }
 }
 
-inline void nnue::half_kp_append_active_indices(const nnboard* pos,const int color,index_list* active){
-  const int ksq=orient(color,pos->squares[color]);
-  for(int i=2;pos->pieces[i];i++){
-    const int sq=pos->squares[i];
-    const int pc=pos->pieces[i];
-    active->values[active->size++]=make_index(color,sq,pc,ksq);
-  }
-}
-
 inline void nnue::half_kp_append_changed_indices(
   const nnboard* pos,
   const int color,
@@ -147,60 +140,18 @@ inline unsigned nnue::orient(const int color,const int square){
   return square^(color==0?0:0x3f);
 }
 
-bool nnue::next_idx(unsigned* idx,unsigned* offset,mask2_t* v,mask_t* mask,
+bool nnue::next_idx(unsigned* idx,unsigned* offset,mask2_t* v,const mask_t* mask,
   const unsigned in_dims){
   while(*v==0){
     *offset+=8*sizeof(mask2_t);
     if(*offset>=in_dims) return false;
-    memcpy(v,reinterpret_cast<char*>(mask)+*offset/8,sizeof(mask2_t));
+    memcpy(v,reinterpret_cast<const char*>(mask)+*offset/8,sizeof(mask2_t));
   }
   *idx=*offset+lsb(*v);
   *v&=*v-1;
   return true;
 }
 
-inline void nnue::affine_txfm(int8_t* input,void* output,unsigned in_dims,
-  unsigned out_dims,int32_t* biases,
-  weight_t* weights,mask_t* in_mask,
-  mask_t* out_mask,const bool pack8_and_calc_mask){
-  (void)out_dims;
-  __m256i k_zero=_mm256_setzero_si256();
-  __m256i out_0=reinterpret_cast<__m256i*>(biases)[0];
-  __m256i out_1=reinterpret_cast<__m256i*>(biases)[1];
-  __m256i out_2=reinterpret_cast<__m256i*>(biases)[2];
-  __m256i out_3=reinterpret_cast<__m256i*>(biases)[3];
-  __m256i first,second;
-  mask2_t v;
-  unsigned idx;
-  memcpy(&v,in_mask,sizeof(mask2_t));
-  for(unsigned offset=0;offset<in_dims;){
-    if(!next_idx(&idx,&offset,&v,in_mask,in_dims)) break;
-    first=reinterpret_cast<__m256i*>(weights)[idx];
-    uint16_t factor=static_cast<unsigned char>(input[idx]);
-    if(next_idx(&idx,&offset,&v,in_mask,in_dims)){
-      second=reinterpret_cast<__m256i*>(weights)[idx];
-      factor|=input[idx]<<8;
-    } else{
-      second=k_zero;
-    }
-    __m256i mul=_mm256_set1_epi16(factor),prod,signs;
-    prod=_mm256_maddubs_epi16(mul,_mm256_unpacklo_epi8(first,second));
-    signs=_mm256_cmpgt_epi16(k_zero,prod);
-    out_0=_mm256_add_epi32(out_0,_mm256_unpacklo_epi16(prod,signs));
-    out_1=_mm256_add_epi32(out_1,_mm256_unpackhi_epi16(prod,signs));
-    prod=_mm256_maddubs_epi16(mul,_mm256_unpackhi_epi8(first,second));
-    signs=_mm256_cmpgt_epi16(k_zero,prod);
-    out_2=_mm256_add_epi32(out_2,_mm256_unpacklo_epi16(prod,signs));
-    out_3=_mm256_add_epi32(out_3,_mm256_unpackhi_epi16(prod,signs));
-  }
-  __m256i out16_0=_mm256_srai_epi16(_mm256_packs_epi32(out_0,out_1),6);
-  __m256i out16_1=_mm256_srai_epi16(_mm256_packs_epi32(out_2,out_3),6);
-  auto out_vec=static_cast<__m256i*>(output);
-  out_vec[0]=_mm256_packs_epi16(out16_0,out16_1);
-  if(pack8_and_calc_mask) out_mask[0]=_mm256_movemask_epi8(_mm256_cmpgt_epi8(out_vec[0],k_zero));
-  else out_vec[0]=_mm256_max_epi8(out_vec[0],k_zero);
-}
-
 inline unsigned nnue::wt_idx(const unsigned r,unsigned c,const unsigned dims){
   (void)dims;
   if(dims>32){
@@ -273,3 +224,344 @@ void nnue::init_weights(const void* eval_data){
   permute_biases(hidden1_biases);
   permute_biases(hidden2_biases);
 }
+
+namespace{
+  constexpr unsigned bias_block(const unsigned o){
+    const unsigned q=o/4;
+    return 4*(q<4?2*q:2*(q-4)+1)+o%4;
+  }
+
+  constexpr unsigned swap_bits34(const unsigned j){
+    return j&~0x18u|(j&0x08)<<1|(j&0x10)>>1;
+  }
+}
+
+simd_level nnue::detect_simd(){
+  const cpu::features& f=cpu::detect();
+  if(!f.sse41) return simd_scalar;
+  if(f.avx512_vnni) return simd_avx512_vnni;
+  if(f.avx2) return simd_avx2;
+  return simd_sse41;
+}
+
+void nnue::select_kernels(const simd_level level){
+  simd=level;
+  update_columns=update_columns_scalar;
+  transform_acc=transform_scalar;
+  affine_txfm=affine_txfm_scalar;
+  affine_propagate=affine_propagate_scalar;
+  if(level>=simd_sse41){
+    update_columns=update_columns_sse41;
+    transform_acc=transform_sse41;
+    affine_txfm=affine_txfm_sse41;
+    affine_propagate=affine_propagate_sse41;
+  }
+  if(level>=simd_avx2){
+    update_columns=update_columns_avx2;
+    transform_acc=transform_avx2;
+    affine_txfm=affine_txfm_avx2;
+    affine_propagate=affine_propagate_avx2;
+  }
+  if(level>=simd_avx512_vnni){
+    update_columns=update_columns_avx512;
+    affine_txfm=affine_txfm_vnni;
+  }
+}
+
+void nnue::update_columns_scalar(const int16_t* src,int16_t* dst,const index_list* removed,
+  const index_list* added){
+  if(dst!=src) memcpy(dst,src,k_half_dimensions*sizeof(int16_t));
+  for(size_t k=0;k<removed->size;k++){
+    const int16_t* column=&ft_weights[k_half_dimensions*removed->values[k]];
+    for(unsigned j=0;j<k_half_dimensions;j++) dst[j]=SC<int16_t>(dst[j]-column[j]);
+  }
+  for(size_t k=0;k<added->size;k++){
+    const int16_t* column=&ft_weights[k_half_dimensions*added->values[k]];
+    for(unsigned j=0;j<k_half_dimensions;j++) dst[j]=SC<int16_t>(dst[j]+column[j]);
+  }
+}
+
+void nnue::transform_scalar(const int16_t* us,const int16_t* them,clipped_t* output,mask_t* out_mask){
+  for(unsigned p=0;p<2;p++){
+    const int16_t* acc=p==0?us:them;
+    clipped_t* out=&output[k_half_dimensions*p];
+    for(unsigned j=0;j<k_half_dimensions;j++)
+      out[j]=SC<clipped_t>(std::clamp(SCI(acc[swap_bits34(j)]),-128,127));
+  }
+  for(unsigned w=0;w<ft_out_dims/32;w++){
+    mask_t m=0;
+    for(unsigned b=0;b<32;b++) if(output[32*w+b]>0) m|=1u<<b;
+    out_mask[w]=m;
+  }
+}
+
+void nnue::affine_txfm_scalar(const int8_t* input,void* output,const unsigned in_dims,const int32_t* biases,
+  const weight_t* weights,const mask_t* in_mask,mask_t* out_mask,const bool pack8_and_calc_mask){
+  int32_t sum[32];
+  for(unsigned o=0;o<32;o++) sum[o]=biases[bias_block(o)];
+  mask2_t v;
+  unsigned idx;
+  memcpy(&v,in_mask,sizeof(mask2_t));
+  for(unsigned offset=0;offset<in_dims;){
+    if(!next_idx(&idx,&offset,&v,in_mask,in_dims)) break;
+    const int factor=SC<unsigned char>(input[idx]);
+    for(unsigned o=0;o<32;o++) sum[o]+=factor*weights[32*idx+o];
+  }
+  const auto out=static_cast<int8_t*>(output);
+  mask_t m=0;
+  for(unsigned o=0;o<32;o++){
+    const int v16=std::clamp(sum[o],-32768,32767)>>6;
+    out[o]=SC<int8_t>(std::clamp(v16,-128,127));
+    if(out[o]>0) m|=1u<<o;
+    else if(!pack8_and_calc_mask) out[o]=0;
+  }
+  if(pack8_and_calc_mask) out_mask[0]=m;
+}
+
+int32_t nnue::affine_propagate_scalar(const clipped_t* input,const int32_t* biases,const weight_t* weights){
+  int32_t sum=biases[0];
+  for(unsigned i=0;i<32;i++) sum+=SC<unsigned char>(input[i])*weights[i];
+  return sum;
+}
+
+TARGET("sse4.1") void nnue::update_columns_sse41(const int16_t* src,int16_t* dst,const index_list* removed,
+  const index_list* added){
+  constexpr unsigned num_regs=8;
+  constexpr unsigned tile_height=num_regs*8;
+  for(unsigned i=0;i<k_half_dimensions/tile_height;i++){
+    const auto src_tile=reinterpret_cast<const __m128i*>(&src[i*tile_height]);
+    const auto dst_tile=reinterpret_cast<__m128i*>(&dst[i*tile_height]);
+    __m128i acc[num_regs];
+    for(unsigned j=0;j<num_regs;j++) acc[j]=src_tile[j];
+    for(size_t k=0;k<removed->size;k++){
+      const unsigned offset=k_half_dimensions*removed->values[k]+i*tile_height;
+      const auto column=reinterpret_cast<const __m128i*>(&ft_weights[offset]);
+      for(unsigned j=0;j<num_regs;j++) acc[j]=_mm_sub_epi16(acc[j],column[j]);
+    }
+    for(size_t k=0;k<added->size;k++){
+      const unsigned offset=k_half_dimensions*added->values[k]+i*tile_height;
+      const auto column=reinterpret_cast<const __m128i*>(&ft_weights[offset]);
+      for(unsigned j=0;j<num_regs;j++) acc[j]=_mm_add_epi16(acc[j],column[j]);
+    }
+    for(unsigned j=0;j<num_regs;j++) dst_tile[j]=acc[j];
+  }
+}
+
+TARGET("sse4.1") void nnue::transform_sse41(const int16_t* us,const int16_t* them,clipped_t* output,
+  mask_t* out_mask){
+  const __m128i k_zero=_mm_setzero_si128();
+  for(unsigned p=0;p<2;p++){
+    const auto acc=reinterpret_cast<const __m128i*>(p==0?us:them);
+    const auto out=reinterpret_cast<__m128i*>(&output[k_half_dimensions*p]);
+    for(unsigned i=0;i<k_half_dimensions/32;i++){
+      out[2*i]=_mm_packs_epi16(acc[4*i],acc[4*i+2]);
+      out[2*i+1]=_mm_packs_epi16(acc[4*i+1],acc[4*i+3]);
+      *out_mask++=SC<mask_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(out[2*i],k_zero)))|
+        SC<mask_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(out[2*i+1],k_zero)))<<16;
+    }
+  }
+}
+
+TARGET("sse4.1") void nnue::affine_txfm_sse41(const int8_t* input,void* output,const unsigned in_dims,
+  const int32_t* biases,const weight_t* weights,const mask_t* in_mask,mask_t* out_mask,
+  const bool pack8_and_calc_mask){
+  const __m128i k_zero=_mm_setzero_si128();
+  const auto bias_vec=reinterpret_cast<const __m128i*>(biases);
+  __m128i out[8];
+  for(unsigned q=0;q<8;q++) out[q]=bias_vec[bias_block(4*q)/4];
+  const auto weight_vec=reinterpret_cast<const __m128i*>(weights);
+  mask2_t v;
+  unsigned idx;
+  memcpy(&v,in_mask,sizeof(mask2_t));
+  for(unsigned offset=0;offset<in_dims;){
+    if(!next_idx(&idx,&offset,&v,in_mask,in_dims)) break;
+    const __m128i first_lo=weight_vec[2*idx];
+    const __m128i first_hi=weight_vec[2*idx+1];
+    __m128i second_lo=k_zero,second_hi=k_zero;
+    uint16_t factor=SC<unsigned char>(input[idx]);
+    if(next_idx(&idx,&offset,&v,in_mask,in_dims)){
+      second_lo=weight_vec[2*idx];
+      second_hi=weight_vec[2*idx+1];
+      factor|=input[idx]<<8;
+    }
+    const __m128i mul=_mm_set1_epi16(SC<short>(factor));
+    const __m128i prods[4]={
+    _mm_maddubs_epi16(mul,_mm_unpacklo_epi8(first_lo,second_lo)),
+    _mm_maddubs_epi16(mul,_mm_unpackhi_epi8(first_lo,second_lo)),
+    _mm_maddubs_epi16(mul,_mm_unpacklo_epi8(first_hi,second_hi)),
+    _mm_maddubs_epi16(mul,_mm_unpackhi_epi8(first_hi,second_hi))
+    };
+    for(unsigned h=0;h<4;h++){
+      out[2*h]=_mm_add_epi32(out[2*h],_mm_cvtepi16_epi32(prods[h]));
+      out[2*h+1]=_mm_add_epi32(out[2*h+1],_mm_cvtepi16_epi32(_mm_srli_si128(prods[h],8)));
+    }
+  }
+  const auto out_vec=static_cast<__m128i*>(output);
+  for(unsigned h=0;h<2;h++){
+    const __m128i out16_0=_mm_srai_epi16(_mm_packs_epi32(out[4*h],out[4*h+1]),6);
+    const __m128i out16_1=_mm_srai_epi16(_mm_packs_epi32(out[4*h+2],out[4*h+3]),6);
+    out_vec[h]=_mm_packs_epi16(out16_0,out16_1);
+  }
+  if(pack8_and_calc_mask)
+    out_mask[0]=SC<mask_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(out_vec[0],k_zero)))|
+      SC<mask_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(out_vec[1],k_zero)))<<16;
+  else{
+    out_vec[0]=_mm_max_epi8(out_vec[0],k_zero);
+    out_vec[1]=_mm_max_epi8(out_vec[1],k_zero);
+  }
+}
+
+TARGET("sse4.1") int32_t nnue::affine_propagate_sse41(const clipped_t* input,const int32_t* biases,
+  const weight_t* weights){
+  const auto iv=reinterpret_cast<const __m128i*>(input);
+  const auto row=reinterpret_cast<const __m128i*>(weights);
+  const __m128i ones=_mm_set1_epi16(1);
+  __m128i sum=_mm_add_epi32(
+    _mm_madd_epi16(_mm_maddubs_epi16(iv[0],row[0]),ones),
+    _mm_madd_epi16(_mm_maddubs_epi16(iv[1],row[1]),ones));
+  sum=_mm_add_epi32(sum,_mm_shuffle_epi32(sum,0x1b));
+  return _mm_cvtsi128_si32(sum)+_mm_extract_epi32(sum,1)+biases[0];
+}
+
+TARGET("avx2") void nnue::update_columns_avx2(const int16_t* src,int16_t* dst,const index_list* removed,
+  const index_list* added){
+  constexpr unsigned num_regs=16;
+  const auto src_tile=reinterpret_cast<const __m256i*>(src);
+  const auto dst_tile=reinterpret_cast<__m256i*>(dst);
+  __m256i acc[num_regs];
+  for(unsigned j=0;j<num_regs;j++) acc[j]=src_tile[j];
+  for(size_t k=0;k<removed->size;k++){
+    const auto column=reinterpret_cast<const __m256i*>(&ft_weights[k_half_dimensions*removed->values[k]]);
+    for(unsigned j=0;j<num_regs;j++) acc[j]=_mm256_sub_epi16(acc[j],column[j]);
+  }
+  for(size_t k=0;k<added->size;k++){
+    const auto column=reinterpret_cast<const __m256i*>(&ft_weights[k_half_dimensions*added->values[k]]);
+    for(unsigned j=0;j<num_regs;j++) acc[j]=_mm256_add_epi16(acc[j],column[j]);
+  }
+  for(unsigned j=0;j<num_regs;j++) dst_tile[j]=acc[j];
+}
+
+TARGET("avx2") void nnue::transform_avx2(const int16_t* us,const int16_t* them,clipped_t* output,
+  mask_t* out_mask){
+  for(unsigned p=0;p<2;p++){
+    const auto acc=reinterpret_cast<const __m256i*>(p==0?us:them);
+    const auto out=reinterpret_cast<__m256i*>(&output[k_half_dimensions*p]);
+    for(unsigned i=0;i<k_half_dimensions/32;i++){
+      out[i]=_mm256_packs_epi16(acc[i*2],acc[i*2+1]);
+      *out_mask++=_mm256_movemask_epi8(_mm256_cmpgt_epi8(out[i],_mm256_setzero_si256()));
+    }
+  }
+}
+
+TARGET("avx2") void nnue::affine_txfm_avx2(const int8_t* input,void* output,const unsigned in_dims,
+  const int32_t* biases,const weight_t* weights,const mask_t* in_mask,mask_t* out_mask,
+  const bool pack8_and_calc_mask){
+  const __m256i k_zero=_mm256_setzero_si256();
+  const auto bias_vec=reinterpret_cast<const __m256i*>(biases);
+  const auto weight_vec=reinterpret_cast<const __m256i*>(weights);
+  __m256i out_0=bias_vec[0];
+  __m256i out_1=bias_vec[1];
+  __m256i out_2=bias_vec[2];
+  __m256i out_3=bias_vec[3];
+  mask2_t v;
+  unsigned idx;
+  memcpy(&v,in_mask,sizeof(mask2_t));
+  for(unsigned offset=0;offset<in_dims;){
+    if(!next_idx(&idx,&offset,&v,in_mask,in_dims)) break;
+    const __m256i first=weight_vec[idx];
+    __m256i second=k_zero;
+    uint16_t factor=SC<unsigned char>(input[idx]);
+    if(next_idx(&idx,&offset,&v,in_mask,in_dims)){
+      second=weight_vec[idx];
+      factor|=input[idx]<<8;
+    }
+    const __m256i mul=_mm256_set1_epi16(SC<short>(factor));
+    __m256i prod=_mm256_maddubs_epi16(mul,_mm256_unpacklo_epi8(first,second));
+    __m256i signs=_mm256_cmpgt_epi16(k_zero,prod);
+    out_0=_mm256_add_epi32(out_0,_mm256_unpacklo_epi16(prod,signs));
+    out_1=_mm256_add_epi32(out_1,_mm256_unpackhi_epi16(prod,signs));
+    prod=_mm256_maddubs_epi16(mul,_mm256_unpackhi_epi8(first,second));
+    signs=_mm256_cmpgt_epi16(k_zero,prod);
+    out_2=_mm256_add_epi32(out_2,_mm256_unpacklo_epi16(prod,signs));
+    out_3=_mm256_add_epi32(out_3,_mm256_unpackhi_epi16(prod,signs));
+  }
+  const __m256i out16_0=_mm256_srai_epi16(_mm256_packs_epi32(out_0,out_1),6);
+  const __m256i out16_1=_mm256_srai_epi16(_mm256_packs_epi32(out_2,out_3),6);
+  const auto out_vec=static_cast<__m256i*>(output);
+  out_vec[0]=_mm256_packs_epi16(out16_0,out16_1);
+  if(pack8_and_calc_mask) out_mask[0]=_mm256_movemask_epi8(_mm256_cmpgt_epi8(out_vec[0],k_zero));
+  else out_vec[0]=_mm256_max_epi8(out_vec[0],k_zero);
+}
+
+TARGET("avx2") int32_t nnue::affine_propagate_avx2(const clipped_t* input,const int32_t* biases,
+  const weight_t* weights){
+  const auto iv=reinterpret_cast<const __m256i*>(input);
+  const auto row=reinterpret_cast<const __m256i*>(weights);
+  __m256i prod=_mm256_maddubs_epi16(iv[0],row[0]);
+  prod=_mm256_madd_epi16(prod,_mm256_set1_epi16(1));
+  __m128i sum=_mm_add_epi32(
+    _mm256_castsi256_si128(prod),
+    _mm256_extracti128_si256(prod,1)
+    );
+  sum=_mm_add_epi32(sum,_mm_shuffle_epi32(sum,0x1b));
+  return _mm_cvtsi128_si32(sum)+_mm_extract_epi32(sum,1)+biases[0];
+}
+
+TARGET("avx512f,avx512bw") void nnue::update_columns_avx512(const int16_t* src,int16_t* dst,
+  const index_list* removed,const index_list* added){
+  constexpr unsigned num_regs=8;
+  const auto src_tile=reinterpret_cast<const __m512i*>(src);
+  const auto dst_tile=reinterpret_cast<__m512i*>(dst);
+  __m512i acc[num_regs];
+  for(unsigned j=0;j<num_regs;j++) acc[j]=src_tile[j];
+  for(size_t k=0;k<removed->size;k++){
+    const auto column=reinterpret_cast<const __m512i*>(&ft_weights[k_half_dimensions*removed->values[k]]);
+    for(unsigned j=0;j<num_regs;j++) acc[j]=_mm512_sub_epi16(acc[j],column[j]);
+  }
+  for(size_t k=0;k<added->size;k++){
+    const auto column=reinterpret_cast<const __m512i*>(&ft_weights[k_half_dimensions*added->values[k]]);
+    for(unsigned j=0;j<num_regs;j++) acc[j]=_mm512_add_epi16(acc[j],column[j]);
+  }
+  for(unsigned j=0;j<num_regs;j++) dst_tile[j]=acc[j];
+}
+
+TARGET("avx512f,avx512bw,avx512vl,avx512vnni") void nnue::affine_txfm_vnni(const int8_t* input,void* output,
+  const unsigned in_dims,const int32_t* biases,const weight_t* weights,const mask_t* in_mask,
+  mask_t* out_mask,const bool pack8_and_calc_mask){
+  const __m256i k_zero=_mm256_setzero_si256();
+  const auto bias_vec=reinterpret_cast<const __m256i*>(biases);
+  const auto weight_vec=reinterpret_cast<const __m256i*>(weights);
+  __m256i out_0=bias_vec[0];
+  __m256i out_1=bias_vec[1];
+  __m256i out_2=bias_vec[2];
+  __m256i out_3=bias_vec[3];
+  mask2_t v;
+  unsigned idx;
+  memcpy(&v,in_mask,sizeof(mask2_t));
+  for(unsigned offset=0;offset<in_dims;){
+    __m256i columns[4]={k_zero,k_zero,k_zero,k_zero};
+    uint32_t factor=0;
+    unsigned n=0;
+    for(;n<4&&next_idx(&idx,&offset,&v,in_mask,in_dims);n++){
+      columns[n]=weight_vec[idx];
+      factor|=SC<uint32_t>(SC<unsigned char>(input[idx]))<<8*n;
+    }
+    if(!n) break;
+    const __m256i mul=_mm256_set1_epi32(SC<int>(factor));
+    const __m256i lo01=_mm256_unpacklo_epi8(columns[0],columns[1]);
+    const __m256i lo23=_mm256_unpacklo_epi8(columns[2],columns[3]);
+    const __m256i hi01=_mm256_unpackhi_epi8(columns[0],columns[1]);
+    const __m256i hi23=_mm256_unpackhi_epi8(columns[2],columns[3]);
+    out_0=_mm256_dpbusd_epi32(out_0,mul,_mm256_unpacklo_epi16(lo01,lo23));
+    out_1=_mm256_dpbusd_epi32(out_1,mul,_mm256_unpackhi_epi16(lo01,lo23));
+    out_2=_mm256_dpbusd_epi32(out_2,mul,_mm256_unpacklo_epi16(hi01,hi23));
+    out_3=_mm256_dpbusd_epi32(out_3,mul,_mm256_unpackhi_epi16(hi01,hi23));
+    if(n<4) break;
+  }
+  const __m256i out16_0=_mm256_srai_epi16(_mm256_packs_epi32(out_0,out_1),6);
+  const __m256i out16_1=_mm256_srai_epi16(_mm256_packs_epi32(out_2,out_3),6);
+  const auto out_vec=static_cast<__m256i*>(output);
+  out_vec[0]=_mm256_packs_epi16(out16_0,out16_1);
+  if(pack8_and_calc_mask) out_mask[0]=_mm256_movemask_epi8(_mm256_cmpgt_epi8(out_vec[0],k_zero));
+  else out_vec[0]=_mm256_max_epi8(out_vec[0],k_zero);
+}
@@ -11,11 +11,13 @@
 #ifdef _WIN64
 #include <Windows.h>
 #else
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
-#include <immintrin.h>
+#include <cstring>
 
 #ifdef _WIN64
 using fd=HANDLE;
@@ -99,16 +101,10 @@ enum : uint16_t{
   k_half_dimensions=256,ft_in_dims=64*ps_end,ft_out_dims=k_half_dimensions*2
 };
 
-enum : uint16_t{
-  num_regs=16,simd_width=256
-};
-
 enum{
   transformer_start=3*4+177,network_start=transformer_start+4+2*256+2*256*64*641
 };
 
-using vec16_t=__m256i;
-using vec8_t=__m256i;
 using mask_t=uint32_t;
 using mask2_t=uint64_t;
 using clipped_t=int8_t;
@@ -131,6 +127,11 @@ using nnue_data=struct nnue_data{
   dirty dirty_piece;
 };
 
+using finny_entry=struct finny_entry{
+  alignas(64) int16_t accumulation[k_half_dimensions];
+  uint64_t piece_bb[13];
+};
+
 using nnboard=struct nnboard{
   int player;
   int* pieces;
@@ -138,7 +139,7 @@ using nnboard=struct nnboard{
   nnue_data* nnue[3];
 };
 
-using index_list=struct{
+using index_list=struct index_list{
   size_t size;
   unsigned values[30];
 };
@@ -149,6 +150,14 @@ struct net_data{
   int8_t hidden2_out[32];
 };
 
+enum simd_level : uint8_t{
+  simd_scalar,simd_sse41,simd_avx2,simd_avx512_vnni,n_simd_levels
+};
+
+inline const char* simd_names[n_simd_levels]={
+"scalar","sse4.1","avx2","avx512-vnni"
+};
+
 inline constexpr uint32_t nnue_version=0x7AF32F16u;
 
 inline int16_t ft_biases alignas(64)[k_half_dimensions];
@@ -160,6 +169,11 @@ inline weight_t hidden2_weights alignas(64)[64*32];
 inline weight_t output_weights alignas(64)[1*32];
 inline int32_t output_biases[1];
 
+inline constexpr int piece_map[16]={
+0,wpawn,wknight,wbishop,wrook,wqueen,wking,blank,
+blank,bpawn,bknight,bbishop,brook,bqueen,bking,blank
+};
+
 inline uint32_t piece_to_index[2][14]={
 {
 0,0,ps_w_queen,ps_w_rook,ps_w_bishop,ps_w_knight,ps_w_pawn,0,
@@ -173,6 +187,12 @@ ps_w_queen,ps_w_rook,ps_w_bishop,ps_w_knight,ps_w_pawn,0
 
 class nnue{
 public:
+  using update_fn=void(*)(const int16_t* src,int16_t* dst,const index_list* removed,const index_list* added);
+  using transform_fn=void(*)(const int16_t* us,const int16_t* them,clipped_t* output,mask_t* out_mask);
+  using affine_txfm_fn=void(*)(const int8_t* input,void* output,unsigned in_dims,const int32_t* biases,
+    const weight_t* weights,const mask_t* in_mask,mask_t* out_mask,bool pack8_and_calc_mask);
+  using affine_propagate_fn=int32_t(*)(const clipped_t* input,const int32_t* biases,const weight_t* weights);
+
   static nnue& instance(){
     static nnue engine("kobra_2.0.nnue");
     return engine;
@@ -206,10 +226,15 @@ public:
     return evaluate_pos(&pos);
   }
 
+  static simd_level detect_simd();
+  static void select_kernels(simd_level level);
+  inline static simd_level simd=simd_scalar;
+
   nnue(const nnue&) = delete;
   nnue& operator=(const nnue&) = delete;
 private:
   explicit nnue(const char* net_path){
+    select_kernels(detect_simd());
     map_t mapping;
     const fd file=open_file(net_path);
     if(file==FD_ERR){
@@ -226,10 +251,10 @@ private:
     }
     init_weights(eval_data);
     if(mapping) unmap_file(eval_data,mapping);
-    SO<<"NNUE loaded: "<<net_path<<SE;
+    SO<<"NNUE loaded: "<<net_path<<" ("<<simd_names[simd]<<")"<<SE;
   }
 
-  static bool next_idx(unsigned*,unsigned*,mask2_t*,mask_t*,unsigned);
+  static bool next_idx(unsigned*,unsigned*,mask2_t*,const mask_t*,unsigned);
   static bool update_accumulator(const nnboard* pos);
   static bool verify_net(const void*,size_t);
   static const char* read_hidden_weights(weight_t*,unsigned,const char*);
@@ -238,89 +263,41 @@ private:
   static unsigned make_index(int color,int sq,int pc,int ksq);
   static unsigned orient(int color,int square);
   static unsigned wt_idx(unsigned,unsigned,unsigned);
-  static void affine_txfm(int8_t*,void*,unsigned,unsigned,int32_t*,weight_t*,mask_t*,mask_t*,bool);
-  static void append_active_indices(const nnboard* pos,index_list active[2]);
   static void append_changed_indices(const nnboard* pos,index_list removed[2],index_list added[2],bool reset[2]);
-  static void half_kp_append_active_indices(const nnboard* pos,int color,index_list* active);
   static void half_kp_append_changed_indices(const nnboard* pos,int color,const dirty_piece* dp,index_list* removed,index_list* added);
   static void init_weights(const void*);
   static void permute_biases(int32_t*);
   static void read_output_weights(weight_t*,const char*);
   static void refresh_accumulator(const nnboard* pos);
+  static void refresh_perspective(const nnboard* pos,int color,int16_t* accumulation);
+
+  static void update_columns_scalar(const int16_t*,int16_t*,const index_list*,const index_list*);
+  static void update_columns_sse41(const int16_t*,int16_t*,const index_list*,const index_list*);
+  static void update_columns_avx2(const int16_t*,int16_t*,const index_list*,const index_list*);
+  static void update_columns_avx512(const int16_t*,int16_t*,const index_list*,const index_list*);
+  static void transform_scalar(const int16_t*,const int16_t*,clipped_t*,mask_t*);
+  static void transform_sse41(const int16_t*,const int16_t*,clipped_t*,mask_t*);
+  static void transform_avx2(const int16_t*,const int16_t*,clipped_t*,mask_t*);
+  static void affine_txfm_scalar(const int8_t*,void*,unsigned,const int32_t*,const weight_t*,const mask_t*,mask_t*,bool);
+  static void affine_txfm_sse41(const int8_t*,void*,unsigned,const int32_t*,const weight_t*,const mask_t*,mask_t*,bool);
+  static void affine_txfm_avx2(const int8_t*,void*,unsigned,const int32_t*,const weight_t*,const mask_t*,mask_t*,bool);
+  static void affine_txfm_vnni(const int8_t*,void*,unsigned,const int32_t*,const weight_t*,const mask_t*,mask_t*,bool);
+  static int32_t affine_propagate_scalar(const clipped_t*,const int32_t*,const weight_t*);
+  static int32_t affine_propagate_sse41(const clipped_t*,const int32_t*,const weight_t*);
+  static int32_t affine_propagate_avx2(const clipped_t*,const int32_t*,const weight_t*);
+
+  inline static update_fn update_columns=update_columns_scalar;
+  inline static transform_fn transform_acc=transform_scalar;
+  inline static affine_txfm_fn affine_txfm=affine_txfm_scalar;
+  inline static affine_propagate_fn affine_propagate=affine_propagate_scalar;
 
   static bool is_king(const int p){
-    return p==white_king||p==black_king;
-  }
-
-  static int32_t affine_propagate(clipped_t* input,const int32_t* biases,weight_t* weights){
-    const auto iv=reinterpret_cast<__m256i*>(input);
-    const auto row=reinterpret_cast<__m256i*>(weights);
-    __m256i prod=_mm256_maddubs_epi16(iv[0],row[0]);
-    prod=_mm256_madd_epi16(prod,_mm256_set1_epi16(1));
-    __m128i sum=_mm_add_epi32(
-      _mm256_castsi256_si128(prod),
-      _mm256_extracti128_si256(prod,1)
-      );
-    sum=_mm_add_epi32(sum,_mm_shuffle_epi32(sum,0x1b));
-    return _mm_cvtsi128_si32(sum)+_mm_extract_epi32(sum,1)+biases[0];
-  }
-
-  static void affine_txfm(
-    int8_t* input,void* output,unsigned in_dims,
-    int32_t* biases,weight_t* weights,mask_t* in_mask,
-    mask_t* out_mask,bool pack8_and_calc_mask
-    ){
-    __m256i k_zero=_mm256_setzero_si256();
-    __m256i out_0=reinterpret_cast<__m256i*>(biases)[0];
-    __m256i out_1=reinterpret_cast<__m256i*>(biases)[1];
-    __m256i out_2=reinterpret_cast<__m256i*>(biases)[2];
-    __m256i out_3=reinterpret_cast<__m256i*>(biases)[3];
-    __m256i first,second;
-    mask2_t v;
-    unsigned idx;
-    memcpy(&v,in_mask,sizeof(mask2_t));
-    for(unsigned offset=0;offset<in_dims;){
-      if(!next_idx(&idx,&offset,&v,in_mask,in_dims)) break;
-      first=reinterpret_cast<__m256i*>(weights)[idx];
-      uint16_t factor=static_cast<unsigned char>(input[idx]);
-      if(next_idx(&idx,&offset,&v,in_mask,in_dims)){
-        second=reinterpret_cast<__m256i*>(weights)[idx];
-        factor|=input[idx]<<8;
-      } else{
-        second=k_zero;
-      }
-      __m256i mul=_mm256_set1_epi16(factor);
-      __m256i prod=_mm256_maddubs_epi16(mul,_mm256_unpacklo_epi8(first,second));
-      __m256i signs=_mm256_cmpgt_epi16(k_zero,prod);
-      out_0=_mm256_add_epi32(out_0,_mm256_unpacklo_epi16(prod,signs));
-      out_1=_mm256_add_epi32(out_1,_mm256_unpackhi_epi16(prod,signs));
-      prod=_mm256_maddubs_epi16(mul,_mm256_unpackhi_epi8(first,second));
-      signs=_mm256_cmpgt_epi16(k_zero,prod);
-      out_2=_mm256_add_epi32(out_2,_mm256_unpacklo_epi16(prod,signs));
-      out_3=_mm256_add_epi32(out_3,_mm256_unpackhi_epi16(prod,signs));
-    }
-    __m256i out16_0=_mm256_srai_epi16(_mm256_packs_epi32(out_0,out_1),6);
-    __m256i out16_1=_mm256_srai_epi16(_mm256_packs_epi32(out_2,out_3),6);
-    auto out_vec=static_cast<__m256i*>(output);
-    out_vec[0]=_mm256_packs_epi16(out16_0,out16_1);
-    if(pack8_and_calc_mask) out_mask[0]=_mm256_movemask_epi8(_mm256_cmpgt_epi8(out_vec[0],k_zero));
-    else out_vec[0]=_mm256_max_epi8(out_vec[0],k_zero);
+    return p==wking||p==bking;
   }
 
   static void transform(const nnboard* pos,clipped_t* output,mask_t* out_mask){
     if(!update_accumulator(pos)) refresh_accumulator(pos);
-    auto& accumulation=pos->nnue[0]->accumulator.accumulation;
-    const int perspectives[2]={pos->player,!pos->player};
-    for(unsigned p=0;p<2;p++){
-      const unsigned offset=k_half_dimensions*p;
-      constexpr unsigned num_chunks=16*k_half_dimensions/simd_width;
-      const auto out=reinterpret_cast<vec8_t*>(&output[offset]);
-      for(unsigned i=0;i<num_chunks/2;i++){
-        const vec16_t s0=reinterpret_cast<vec16_t*>(accumulation[perspectives[p]])[i*2];
-        const vec16_t s1=reinterpret_cast<vec16_t*>(accumulation[perspectives[p]])[i*2+1];
-        out[i]=_mm256_packs_epi16(s0,s1);
-        *out_mask++=_mm256_movemask_epi8(_mm256_cmpgt_epi8(out[i],_mm256_setzero_si256()));
-      }
-    }
+    const auto& accumulation=pos->nnue[0]->accumulator.accumulation;
+    transform_acc(accumulation[pos->player],accumulation[!pos->player],output,out_mask);
   }
 };
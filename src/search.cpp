@@ -1,20 +1,32 @@
 #include "search.h"
 #include <cassert>
+#include <iomanip>
 #include <sstream>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "eval.h"
 #include "hash.h"
 
 template<bool MainThread> u16 search_info::best_move(board& pos,const thread_id id){
   if(MainThread){
+    hash.new_search();
     for(const auto& td:thread_info){
       td->pv.clear();
-      td->node_count=0;
+      td->node_count.reset();
+      td->stats.reset();
       td->root_depth=1;
     }
-    for(thread_id i=1;i<num_threads;++i) threads.emplace_back(&search_info::best_move<false>,this,std::ref(pos),i);
+    if(pin_threads) pin_thread(0);
+    arm_timer();
+    run_helpers([this,&pos](const thread_id i){
+      best_move<false>(pos,i);
+    });
   }
   thread_data& td=*thread_info[id];
-  board copy(pos);
+  thread_stats=&td.stats;
+  td.pos=pos;
   int alpha;
   int beta;
   int score=0;
@@ -38,8 +50,8 @@ template<bool MainThread> u16 search_info::best_move(board& pos,const thread_id
       beta=SCI(std::min(score+delta,+infinite_score));
     }
     for(;;){
-      score=alpha_beta<root>(copy,alpha,beta,td.root_depth,td,ss);
-      if(time.stop) break;
+      score=alpha_beta<root>(td.pos,alpha,beta,td.root_depth,td,ss);
+      if(stopped()) break;
       if(score<=alpha){
         beta=(alpha+beta)/2;
         alpha=SCI(std::max(alpha-delta,-infinite_score));
@@ -47,19 +59,22 @@ template<bool MainThread> u16 search_info::best_move(board& pos,const thread_id
       else break;
       delta+=delta/3;
     }
-    if(time.stop) break;
+    if(stopped()) break;
     prev_score=score;
     td.pv.clear();
     for(int i=0;i<ss->pv_size;++i) td.pv.push_back(ss->pv[i]);
     if(MainThread){
       SO<<info(td,td.root_depth,score)<<SE;
+#if defined(STATS)
+      SO<<stats_info()<<std::flush;
+#endif
     }
     ++td.root_depth;
   }
   if(MainThread){
     stop();
-    for(auto& t:threads) t.join();
-    threads.clear();
+    wait_helpers();
+    disarm_timer();
     if(time.use_node_limit||time.use_move_limit){
       SO<<info(td,td.root_depth,prev_score)<<SE;
     }
@@ -75,11 +90,12 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
   thread_data& td,search_stack* ss){
   constexpr bool root_node=St==root;
   constexpr bool pv_node=St!=non_pv;
-  if(const bool main_thread=td.id==0;main_thread&&depth>=5) time.update(node_count());
-  if(time.stop) return stop_score;
+  if(stopped()) return stop_score;
   if(pos.is_draw()) return draw_score;
   if(depth<=0) return quiescence<pv_node?node_pv:non_pv>(pos,alpha,beta,td,ss);
-  ++td.node_count;
+  td.node_count.increment();
+  STAT(main_nodes);
+  check_node_limit(td);
   if(!root_node){
     alpha=SCI(
       std::max(-mate_score+ss->ply,alpha));
@@ -91,11 +107,11 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
   hash_entry he;
   const bool hash_hit=hash.probe(key,he);
   const int hash_score=
-    hash_table::score_from_hash(he.data_union.entry_data.score,ss->ply);
-  if(!pv_node&&!SkipHashMove&&hash_hit&&depth<=he.data_union.entry_data.depth){
-    if(he.data_union.entry_data.nt==pvnode||
-      he.data_union.entry_data.nt==cutnode&&hash_score>=beta||
-      he.data_union.entry_data.nt==allnode&&hash_score<=alpha){
+    hash_table::score_from_hash(he.score,ss->ply);
+  if(!pv_node&&!SkipHashMove&&hash_hit&&depth<=he.depth){
+    if(he.nt()==pvnode||
+      he.nt()==cutnode&&hash_score>=beta||
+      he.nt()==allnode&&hash_score<=alpha){
       if(pos.st->fifty_move_count<90) return hash_score;
     }
   }
@@ -103,11 +119,11 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
   int eval;
   if(is_in_check) eval=ss->static_eval=-infinite_score;
   else if(hash_hit){
-    ss->static_eval=he.data_union.entry_data.eval;
-    if(depth<=he.data_union.entry_data.depth&&
-      (he.data_union.entry_data.nt==pvnode||
-        he.data_union.entry_data.nt==cutnode&&hash_score>ss->static_eval||
-        he.data_union.entry_data.nt==allnode&&hash_score<ss->static_eval)){
+    ss->static_eval=he.eval;
+    if(depth<=he.depth&&
+      (he.nt()==pvnode||
+        he.nt()==cutnode&&hash_score>ss->static_eval||
+        he.nt()==allnode&&hash_score<ss->static_eval)){
       eval=hash_score;
     } else eval=ss->static_eval;
   } else eval=ss->static_eval=eval::evaluate(pos);
@@ -122,12 +138,14 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
       ss->static_eval>=beta-22*depth+400&&depth<12){
       const i32 r=(13+depth)/5;
       ss->move=u16();
+      STAT(null_tries);
       pos.apply_null_move();
       int null_score=-alpha_beta<non_pv>(
         pos,-beta,-alpha,
         depth-r,td,ss+1);
       pos.undo_null_move();
       if(null_score>=beta){
+        STAT(null_cutoffs);
         if(null_score>=min_mate_score) null_score=beta;
         return null_score;
       }
@@ -135,18 +153,22 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
     if(pv_node&&!hash_hit) --depth;
     if(depth<=0) return quiescence<pv_node?node_pv:non_pv>(pos,alpha,beta,td,ss);
   }
-  const u16 hash_move=hash_hit?he.data_union.entry_data.move:u16();
-  move_sort move_sorter(pos,ss,td.histories,hash_move,is_in_check);
+  const u16 hash_move=hash_hit?he.move:u16();
+  move_sort move_sorter(pos,ss,td.histories,hash_move,is_in_check,depth);
+  STAT(move_pickers);
   int best_score=-infinite_score;
   int score=0;
   u16 best_move=u16();
   int move_count=0;
+  move_list searched;
   for(;;){
     const u16 m=move_sorter.next();
     if(!m) break;
+    STAT(moves_picked);
     if(pv_node) (ss+1)->pv_size=0;
     ++move_count;
     if(SkipHashMove&&m==ss->hash_move) continue;
+    searched.add(m);
     const bool is_capture=pos.is_capture(m);
     const u8 from=move::from(m);
     const u8 to=move::to(m);
@@ -175,21 +197,25 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
       }
     }
     ss->move=m;
+    hash.prefetch(pos.key_after(m));
     int ext=0;
     bool lmr=false;
     if(move_count==1){
       if(!root_node&&!SkipHashMove&&depth>=8&&m==hash_move&&
-        (he.data_union.entry_data.nt==cutnode||he.data_union.entry_data.nt==pvnode)&&
-        he.data_union.entry_data.depth+3>=depth&&std::abs(eval)<min_mate_score){
+        (he.nt()==cutnode||he.nt()==pvnode)&&
+        he.depth+3>=depth&&std::abs(eval)<min_mate_score){
         const int singular_beta=
           std::min(eval-2*depth,beta);
         const i32 singular_depth=depth/2;
         ss->hash_move=m;
+        STAT(singular_searches);
         score=
           alpha_beta<non_pv,true>(pos,singular_beta-1,
             singular_beta,singular_depth,td,ss);
-        if(score<singular_beta) ext=1;
-        else if(hash_score>=beta) ext=-1;
+        if(score<singular_beta){
+          ext=1;
+          STAT(singular_extensions);
+        } else if(hash_score>=beta) ext=-1;
         new_depth+=ext;
       }
     } else{
@@ -227,16 +253,19 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
     }
     pos.apply_move(m);
     if(lmr){
+      STAT(lmr_searches);
       ext=
         SCI32(std::round(ext/SCDO(lmr_factor)));
       const i32 d=
         std::clamp(new_depth+ext,0,+new_depth+1);
       score=-alpha_beta<non_pv>(pos,-alpha-1,
         -alpha,d,td,ss+1);
-      if(ext<0&&score>alpha)
+      if(ext<0&&score>alpha){
+        STAT(lmr_researches);
         score=-alpha_beta<non_pv>(
           pos,-alpha-1,-alpha,
           new_depth,td,ss+1);
+      }
     } else if(!pv_node||move_count>1)
       score=-alpha_beta<non_pv>(pos,-alpha-1,
         -alpha,new_depth,td,ss+1);
@@ -245,7 +274,7 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
       score=-alpha_beta<node_pv>(pos,-beta,
         -alpha,new_depth,td,ss+1);
     pos.undo_move();
-    if(time.stop) return stop_score;
+    if(stopped()) return stop_score;
     if(score>best_score){
       best_score=score;
       if(pv_node){
@@ -256,7 +285,11 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
       if(score>alpha){
         best_move=m;
         if(score<beta) alpha=score;
-        else break;
+        else{
+          STAT(beta_cutoffs);
+          if(searched.size()==1) STAT(first_move_cutoffs);
+          break;
+        }
       }
     }
   }
@@ -268,7 +301,7 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
       :pv_node&&best_move
       ?pvnode
       :allnode;
-    if(best_move) td.histories.update(pos,ss,best_move,move_sorter.moves,depth);
+    if(best_move) td.histories.update(pos,ss,best_move,searched,depth);
     hash.save(key,hash_table::score_to_hash(best_score,ss->ply),
       ss->static_eval,best_move,depth,nt);
   }
@@ -278,25 +311,27 @@ template<search_type St,bool SkipHashMove> int search_info::alpha_beta(board& po
 template<search_type St> int search_info::quiescence(board& pos,int alpha,const int beta,thread_data& td,
   search_stack* ss){
   constexpr bool pv_node=St==node_pv;
-  ++td.node_count;
-  if(time.stop) return stop_score;
+  td.node_count.increment();
+  STAT(qsearch_nodes);
+  check_node_limit(td);
+  if(stopped()) return stop_score;
   if(pos.is_draw()) return draw_score;
   if(ss->ply>=max_ply) return pos.is_in_check()?draw_score:eval::evaluate(pos);
   const u64 key=pos.key();
   hash_entry he;
   const bool hash_hit=hash.probe(key,he);
-  const int hash_score=hash_table::score_from_hash(he.data_union.entry_data.score,ss->ply);
+  const int hash_score=hash_table::score_from_hash(he.score,ss->ply);
   if(!pv_node&&hash_hit&&
-    (he.data_union.entry_data.nt==pvnode||he.data_union.entry_data.nt==cutnode&&hash_score>=beta||
-      he.data_union.entry_data.nt==allnode&&hash_score<=alpha))
+    (he.nt()==pvnode||he.nt()==cutnode&&hash_score>=beta||
+      he.nt()==allnode&&hash_score<=alpha))
     return hash_score;
   const bool is_in_check=pos.is_in_check();
   int best_score;
   if(is_in_check) best_score=ss->static_eval=-infinite_score;
-  else best_score=ss->static_eval=hash_hit?he.data_union.entry_data.eval:eval::evaluate(pos);
-  if(hash_hit&&(he.data_union.entry_data.nt==pvnode||
-    he.data_union.entry_data.nt==cutnode&&hash_score>best_score||
-    he.data_union.entry_data.nt==allnode&&hash_score<best_score))
+  else best_score=ss->static_eval=hash_hit?he.eval:eval::evaluate(pos);
+  if(hash_hit&&(he.nt()==pvnode||
+    he.nt()==cutnode&&hash_score>best_score||
+    he.nt()==allnode&&hash_score<best_score))
     best_score=hash_score;
   if(!is_in_check){
     if(best_score>=beta){
@@ -309,18 +344,19 @@ template<search_type St> int search_info::quiescence(board& pos,int alpha,const
     }
     if(pv_node&&best_score>alpha) alpha=best_score;
   }
-  u16 best_move=hash_hit?he.data_union.entry_data.move:u16();
-  move_sort move_sorter(pos,ss,td.histories,best_move,is_in_check);
+  u16 best_move=hash_hit?he.move:u16();
+  move_sort move_sorter(pos,ss,td.histories,best_move,is_in_check,0,true);
+  STAT(move_pickers);
+  int move_count=0;
   for(;;){
     const u16 m=move_sorter.next();
     if(!m) break;
-    const bool is_capture=pos.is_capture(m);
-    if(const bool is_queen_promotion=
-      board::is_promotion(m)&&move::get_piece_type(m)==queen;!is_in_check&&!(is_capture||is_queen_promotion))
-      continue;
-    if(is_capture&&!is_in_check){
-      if(const int see=pos.see(m);see<eval::pt_values[knight]-eval::pt_values[bishop]) continue;
+    STAT(moves_picked);
+    ++move_count;
+    if(pos.is_capture(m)&&!is_in_check){
+      if(!pos.see_ge(m,eval::pt_values[knight]-eval::pt_values[bishop])) continue;
     }
+    hash.prefetch(pos.key_after(m));
     ss->moved=pos.piece_on(move::from(m));
     ss->move=m;
     pos.apply_move(m);
@@ -335,7 +371,7 @@ template<search_type St> int search_info::quiescence(board& pos,int alpha,const
       }
     }
   }
-  if(!move_sorter.moves.size()) return is_in_check?-mate_score+ss->ply:draw_score;
+  if(is_in_check&&!move_count) return -mate_score+ss->ply;
   const node_type nt=best_score>=beta
     ?cutnode
     :pv_node&&best_move
@@ -352,7 +388,7 @@ std::string search_info::info(const thread_data& td,const i32 depth,
   ss<<"info"<<" depth "<<depth;
   const time_point elapsed=time.elapsed()+1;
   const u64 nodes=node_count();
-  ss<<" nodes "<<nodes<<" time "<<elapsed<<" nps "<<nodes*1000/elapsed;
+  ss<<" nodes "<<nodes<<" time "<<elapsed<<" nps "<<nodes*1000/elapsed<<" hashfull "<<hash.hashfull();
   if(std::abs(score)<min_mate_score) ss<<" score cp "<<score;
   else
     ss<<" score mate "
@@ -364,6 +400,36 @@ std::string search_info::info(const thread_data& td,const i32 depth,
   return ss.str();
 }
 
+std::string search_info::stats_info() const{
+  u64 total[n_stats]{};
+  for(const auto& td:thread_info){
+    for(int i=0;i<n_stats;++i) total[i]+=td->stats.get(SC<stat_kind>(i));
+  }
+  const auto pct=[](const u64 part,const u64 whole){
+    return whole?100.0*SCDO(part)/SCDO(whole):0.0;
+  };
+  std::stringstream ss;
+  ss<<std::fixed<<std::setprecision(1);
+  ss<<"info string tt probes "<<total[tt_probes]<<" hits "<<total[tt_hits]
+    <<" ("<<pct(total[tt_hits],total[tt_probes])<<"%) writes "<<total[tt_writes]
+    <<" overwrites "<<total[tt_overwrites]<<NL;
+  ss<<"info string cutoffs "<<total[beta_cutoffs]<<" first move "
+    <<pct(total[first_move_cutoffs],total[beta_cutoffs])<<"%"<<NL;
+  ss<<"info string nodes main "<<total[main_nodes]<<" qsearch "<<total[qsearch_nodes]
+    <<" ("<<pct(total[qsearch_nodes],total[main_nodes]+total[qsearch_nodes])<<"%)"<<NL;
+  ss<<"info string evals "<<total[evals]<<" nnue refreshes "<<total[nnue_refreshes]
+    <<" updates "<<total[nnue_updates]<<NL;
+  ss<<"info string null tries "<<total[null_tries]<<" cutoffs "<<total[null_cutoffs]
+    <<" ("<<pct(total[null_cutoffs],total[null_tries])<<"%) lmr searches "<<total[lmr_searches]
+    <<" researches "<<total[lmr_researches]<<" ("<<pct(total[lmr_researches],total[lmr_searches])
+    <<"%) singular searches "<<total[singular_searches]<<" extensions "<<total[singular_extensions]
+    <<" ("<<pct(total[singular_extensions],total[singular_searches])<<"%)"<<NL;
+  ss<<"info string move pickers "<<total[move_pickers]<<" generated "<<total[moves_generated]
+    <<" picked "<<total[moves_picked]<<" ("<<pct(total[moves_picked],total[moves_generated])
+    <<"%) per node "<<(total[move_pickers]?SCDO(total[moves_picked])/SCDO(total[move_pickers]):0.0)<<NL;
+  return ss.str();
+}
+
 void search_info::init(){
   for(int d=1;d<max_depth;++d)
     for(int m=1;m<max_moves;++m)
@@ -378,21 +444,128 @@ void search_info::init(){
 }
 
 void search_info::stop(){
-  time.stop=true;
+  stop_signal.set(true);
+}
+
+void search_info::check_node_limit(const thread_data& td){
+  if(time.use_node_limit&&td.node_count.get()%node_check_interval==0&&
+    node_count()>=time.node_limit)
+    stop();
+}
+
+void search_info::arm_timer(){
+  const time_point hard=time.hard_limit();
+  if(hard==std::numeric_limits<time_point>::max()) return;
+  std::scoped_lock lock(timer_mutex);
+  ++timer_generation;
+  timer_armed=true;
+  timer_fired=false;
+  timer_cv.notify_all();
+}
+
+void search_info::disarm_timer(){
+  std::scoped_lock lock(timer_mutex);
+#if defined(STATS)
+  if(timer_fired){
+    const auto latency=std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now()-timer_fired_at).count();
+    SO<<"info string stop latency "<<latency<<" us"<<SE;
+  }
+#endif
+  timer_armed=false;
+  timer_fired=false;
+  timer_cv.notify_all();
+}
+
+void search_info::timer_loop(){
+  std::unique_lock lock(timer_mutex);
+  u64 generation=0;
+  for(;;){
+    timer_cv.wait(lock,[&]{return exit_timer||(timer_armed&&timer_generation!=generation);});
+    if(exit_timer) return;
+    generation=timer_generation;
+    const auto deadline=std::chrono::steady_clock::time_point(milliseconds(time.begin+time.hard_limit()));
+    const auto disarmed=[&]{return exit_timer||!timer_armed||timer_generation!=generation;};
+    if(timer_cv.wait_until(lock,deadline,disarmed)) continue;
+    timer_fired_at=std::chrono::steady_clock::now();
+    timer_fired=true;
+    stop();
+    timer_cv.wait(lock,disarmed);
+  }
 }
 
 void search_info::set_hash_size(const size_t mb){
   hash.set_size(mb);
+  clear_hash();
 }
 
 u64 search_info::node_count() const{
   u64 sum=0;
-  for(const auto& td:thread_info) sum+=td->node_count;
+  for(const auto& td:thread_info) sum+=td->node_count.get();
   return sum;
 }
 
+perft_result search_info::perft(board& pos,const int depth,const bool use_hash){
+  struct perft_task{
+    size_t root;
+    u16 reply;
+  };
+  perft_result result;
+  if(use_hash){
+    if(!perft_tt.entries) perft_tt.resize(perft_hash_mb);
+    else perft_tt.clear();
+  }
+  move_list moves;
+  gen_moves(pos,moves);
+  std::vector<perft_task> tasks;
+  for(size_t i=0;i<moves.size();++i){
+    if(depth<2){
+      tasks.push_back({i,0});
+      continue;
+    }
+    pos.apply_move(moves.move(i));
+    move_list replies;
+    gen_moves(pos,replies);
+    pos.undo_move();
+    for(const auto& [reply,score]:replies) tasks.push_back({i,reply});
+  }
+  std::vector<std::atomic<u64>> counts(moves.size());
+  std::atomic<size_t> next_task=0;
+  result.thread_nodes.assign(num_threads,0);
+  result.thread_tasks.assign(num_threads,0);
+  auto work=[&](const thread_id id){
+    board& b=thread_info[id]->pos;
+    b=pos;
+    u64 nodes=0;
+    u64 done=0;
+    for(size_t t;(t=next_task.fetch_add(1,std::memory_order_relaxed))<tasks.size();++done){
+      const perft_task& task=tasks[t];
+      u64 cnt=1;
+      if(depth>=2){
+        b.apply_move(moves.move(task.root));
+        b.apply_move(task.reply);
+        cnt=::perft(b,depth-2,use_hash?&perft_tt:nullptr);
+        b.undo_move();
+        b.undo_move();
+      }
+      counts[task.root].fetch_add(cnt,std::memory_order_relaxed);
+      nodes+=cnt;
+    }
+    result.thread_nodes[id]=nodes;
+    result.thread_tasks[id]=done;
+  };
+  run_helpers(work);
+  work(0);
+  wait_helpers();
+  for(size_t i=0;i<moves.size();++i){
+    result.divide.emplace_back(moves.move(i),counts[i].load());
+    result.nodes+=counts[i].load();
+  }
+  return result;
+}
+
 void search_info::clear(){
-  hash.clear();
+  clear_hash();
   while(!thread_info.empty()){
     delete thread_info.back();
     thread_info.pop_back();
@@ -400,7 +573,17 @@ void search_info::clear(){
   for(thread_id i=0;i<num_threads;++i) thread_info.push_back(new thread_data(i));
 }
 
+void search_info::clear_hash(){
+  run_helpers([this](const thread_id i){
+    hash.clear_slice(i,num_threads);
+  });
+  hash.clear_slice(0,num_threads);
+  wait_helpers();
+  hash.generation=0;
+}
+
 void search_info::set_num_threads(const thread_id threadnum){
+  destroy_pool();
   this->num_threads=std::clamp(threadnum, SCTI(1),
     std::min(std::thread::hardware_concurrency(),
       SCTI(max_threads)));
@@ -409,4 +592,74 @@ void search_info::set_num_threads(const thread_id threadnum){
     thread_info.pop_back();
   }
   for(thread_id i=0;i<this->num_threads;++i) thread_info.push_back(new thread_data(i));
+  exit_pool=false;
+  exit_timer=false;
+  for(thread_id i=1;i<this->num_threads;++i) threads.emplace_back(&search_info::idle_loop,this,i,job_id);
+  timer=std::thread(&search_info::timer_loop,this);
+}
+
+search_info::~search_info(){
+  destroy_pool();
+}
+
+void search_info::destroy_pool(){
+  {
+    std::scoped_lock lock(pool_mutex);
+    exit_pool=true;
+  }
+  pool_cv.notify_all();
+  for(auto& t:threads) t.join();
+  threads.clear();
+  {
+    std::scoped_lock lock(timer_mutex);
+    exit_timer=true;
+  }
+  timer_cv.notify_all();
+  if(timer.joinable()) timer.join();
+}
+
+void search_info::idle_loop(const thread_id id,u64 seen){
+  if(pin_threads) pin_thread(id);
+  for(;;){
+    std::function<void(thread_id)> job;
+    {
+      std::unique_lock lock(pool_mutex);
+      pool_cv.wait(lock,[&]{return exit_pool||job_id!=seen;});
+      if(exit_pool) return;
+      seen=job_id;
+      job=helper_job;
+    }
+    job(id);
+    std::scoped_lock lock(pool_mutex);
+    if(--active_helpers==0) done_cv.notify_all();
+  }
+}
+
+void search_info::run_helpers(std::function<void(thread_id)> job){
+  {
+    std::scoped_lock lock(pool_mutex);
+    helper_job=std::move(job);
+    active_helpers=SCTI(threads.size());
+    ++job_id;
+  }
+  pool_cv.notify_all();
+}
+
+void search_info::wait_helpers(){
+  std::unique_lock lock(pool_mutex);
+  done_cv.wait(lock,[this]{return active_helpers==0;});
+}
+
+void search_info::pin_thread(const thread_id id){
+  const unsigned cpu=id%std::max(1u,std::thread::hardware_concurrency());
+#ifdef _WIN64
+  SetThreadAffinityMask(GetCurrentThread(),SC<DWORD_PTR>(1)<<cpu%64);
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu,&set);
+  pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+#else
+  (void)cpu;
+#endif
 }
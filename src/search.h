@@ -1,11 +1,18 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <thread>
 #include "chrono.h"
 #include "hash.h"
 #include "movesort.h"
+#include "stats.h"
 
 constexpr int min_display_time=5000;
+constexpr u64 node_check_interval=256;
 constexpr int max_threads=256;
+constexpr size_t perft_hash_mb=64;
 inline constexpr int continuation_ply=6;
 
 enum search_type : u8{
@@ -22,38 +29,113 @@ struct search_stack{
   u16 pv[max_depth];
 };
 
+struct alignas(cache_line) node_counter{
+  std::atomic<u64> nodes{0};
+
+  void increment(){
+    nodes.store(nodes.load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] u64 get() const{
+    return nodes.load(std::memory_order_relaxed);
+  }
+
+  void reset(){
+    nodes.store(0,std::memory_order_relaxed);
+  }
+};
+
+struct alignas(cache_line) stop_flag{
+  std::atomic<bool> flag{false};
+
+  [[nodiscard]] bool get() const{
+    return flag.load(std::memory_order_relaxed);
+  }
+
+  void set(const bool value){
+    flag.store(value,std::memory_order_relaxed);
+  }
+};
+
 struct thread_data{
-  explicit thread_data(const thread_id id) : root_depth(0), stack{}, id(id), node_count(0){}
+  explicit thread_data(const thread_id id) : root_depth(0), stack{}, id(id){}
   history histories;
   i32 root_depth;
   search_stack stack[max_ply+continuation_ply];
   std::vector<u16> pv;
-  thread_data() : root_depth(0), stack{}, id(0), node_count(0){}
+  thread_data() : root_depth(0), stack{}, id(0){}
   thread_id id;
-  u64 node_count;
+  node_counter node_count;
+  search_stats stats;
+  board pos;
+};
+
+struct perft_result{
+  std::vector<std::pair<u16,u64>> divide;
+  std::vector<u64> thread_nodes;
+  std::vector<u64> thread_tasks;
+  u64 nodes=0;
 };
 
 struct search_info{
+  search_info()=default;
+  search_info(const search_info&)=delete;
+  search_info& operator=(const search_info&)=delete;
+  ~search_info();
   [[nodiscard]] std::string info(const thread_data& td,i32 depth,int score) const;
+  [[nodiscard]] std::string stats_info() const;
+  [[nodiscard]] bool stopped() const{
+    return stop_signal.get();
+  }
+
   [[nodiscard]] u64 node_count() const;
+  perft_result perft(board& pos,int depth,bool use_hash=true);
   chrono time;
   constexpr static i16 lmr_factor=1000;
   hash_table hash;
+  perft_table perft_tt;
   inline static i32 forward_pruning_table[max_depth][max_moves];
   inline static i32 log_reduction_table[max_depth][max_moves];
   inline static i32 move_count_pruning_table[max_depth];
   static void init();
+  static void pin_thread(thread_id id);
+  std::condition_variable done_cv;
+  std::condition_variable pool_cv;
+  std::function<void(thread_id)> helper_job;
+  std::mutex pool_mutex;
+  stop_flag stop_signal;
+  std::chrono::steady_clock::time_point timer_fired_at;
+  std::condition_variable timer_cv;
+  std::mutex timer_mutex;
+  std::thread timer;
   std::vector<std::thread> threads;
   std::vector<thread_data*> thread_info;
   template<bool MainThread=true> u16 best_move(board& pos,thread_id id=0);
   template<search_type St,bool SkipHashMove=false> int alpha_beta(board& pos,int alpha,int beta,i32 depth,
     thread_data& td,search_stack* ss);
   template<search_type St> int quiescence(board& pos,int alpha,int beta,thread_data& td,search_stack* ss);
+  thread_id active_helpers=0;
   thread_id num_threads=1;
+  bool exit_pool=false;
+  bool exit_timer=false;
+  bool pin_threads=false;
+  bool timer_armed=false;
+  bool timer_fired=false;
+  u64 job_id=0;
+  u64 timer_generation=0;
+  void arm_timer();
+  void check_node_limit(const thread_data& td);
   void clear();
+  void clear_hash();
+  void disarm_timer();
+  void destroy_pool();
+  void idle_loop(thread_id id,u64 seen);
+  void run_helpers(std::function<void(thread_id)> job);
   void set_hash_size(size_t mb);
   void set_num_threads(thread_id threadnum);
   void stop();
+  void timer_loop();
+  void wait_helpers();
 };
 
 extern template u16 search_info::best_move<true>(board& pos,thread_id id);
@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+#include "main.h"
+
+enum stat_kind : u8{
+  tt_probes,tt_hits,tt_writes,tt_overwrites,
+  beta_cutoffs,first_move_cutoffs,main_nodes,qsearch_nodes,
+  evals,nnue_refreshes,nnue_updates,
+  null_tries,null_cutoffs,lmr_searches,lmr_researches,
+  singular_searches,singular_extensions,
+  move_pickers,moves_generated,moves_picked,
+  n_stats
+};
+
+struct search_stats{
+  std::atomic<u64> counts[n_stats]{};
+
+  void add(const stat_kind s,const u64 n=1){
+    counts[s].store(counts[s].load(std::memory_order_relaxed)+n,std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] u64 get(const stat_kind s) const{
+    return counts[s].load(std::memory_order_relaxed);
+  }
+
+  void reset(){
+    for(auto& c:counts) c.store(0,std::memory_order_relaxed);
+  }
+};
+
+inline thread_local search_stats* thread_stats=nullptr;
+
+#if defined(STATS)
+#define STAT(s) do{ if(thread_stats) thread_stats->add(s); } while(0)
+#define STAT_N(s,n) do{ if(thread_stats) thread_stats->add(s,SCU64(n)); } while(0)
+#else
+#define STAT(s) do{} while(0)
+#define STAT_N(s,n) do{} while(0)
+#endif
@@ -1,17 +1,21 @@
 #include "uci.h"
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <unordered_map>
+#include "attack.h"
 #include "movegen.h"
 #include "nnue.h"
 
 void uci::init(){
   use_nnue=true;
   (void)nnue::instance();
-  pos=board(start_fen);
-  search.set_hash_size(default_hash);
+  pos.set(start_fen);
   search.set_num_threads(default_threads);
+  search.set_hash_size(default_hash);
+  hash_info();
   loop();
 }
 
@@ -28,7 +32,12 @@ void uci::loop(){
   {"stop",[](std::istringstream&) {stop(); }},
   {"quit",[](std::istringstream&) {stop(); exit(0); }},
   {"print",[](std::istringstream&) {SO << pos << NL << pos.fen() << NL; }},
-  {"perft",perft}};
+  {"perft",perft},
+  {"bench",bench},
+  {"stats",[](std::istringstream&) {stats(); }},
+  {"hashstats",[](std::istringstream&) {hash_stats(); }},
+  {"perftsuite",perftsuite},
+  {"attackbench",[](std::istringstream&) {attack::bench(); }}};
 
   while(std::getline(std::cin,line)){
 	    std::istringstream ss(line);
@@ -46,6 +55,27 @@ void uci::info(){
   SO<<"uciok"<<SE;
 }
 
+void uci::hash_info(){
+  static constexpr const char* page_names[]={"small","transparent","large"};
+  const hash_table& hash=search.hash;
+  SO<<"info string Hash "<<hash.size_mb<<" MB, "<<page_names[hash.pages]<<" pages, "
+    <<hash.huge_page_bytes()/(1024*1024)<<" MB backed by huge pages"<<SE;
+}
+
+void uci::hash_stats(){
+  static constexpr const char* bound_names[]={"none","pv","cut","all"};
+  const hash_usage u=search.hash.usage();
+  SO<<"info string hashfull "<<search.hash.hashfull()<<" entries "<<u.entries<<" used "<<u.used
+    <<" ("<<(u.entries?1000*u.used/u.entries:0)<<" permill)"<<NL;
+  SO<<"info string bound";
+  for(int i=pvnode;i<=allnode;++i) SO<<" "<<bound_names[i]<<" "<<u.by_bound[i];
+  SO<<NL<<"info string age";
+  for(size_t i=0;i<std::size(u.by_age);++i) if(u.by_age[i]) SO<<" "<<i<<":"<<u.by_age[i];
+  SO<<NL<<"info string depth";
+  for(size_t i=0;i<std::size(u.by_depth);++i) if(u.by_depth[i]) SO<<" "<<i<<":"<<u.by_depth[i];
+  SO<<SE;
+}
+
 void uci::newgame(){
   search.clear();
 }
@@ -71,9 +101,17 @@ void uci::setoption(std::istringstream& ss){
   }
   if(name=="Hash"){
     const u64 hash_size=std::stoull(value);
-    search.hash.set_size(hash_size);
+    search.set_hash_size(hash_size);
+    hash_info();
+  } else if(name=="LargePages"){
+    search.hash.use_large_pages=value=="true"||value=="1";
+    search.set_hash_size(search.hash.size_mb);
+    hash_info();
   } else if(name=="Threads"){
     search.set_num_threads(std::stoi(value));
+  } else if(name=="PinThreads"){
+    search.pin_threads=value=="true"||value=="1";
+    search.set_num_threads(search.num_threads);
   } else if(name=="Contempt"){
     contempt=std::stoi(value);
   } else if(name=="UseNNUE"){
@@ -93,10 +131,11 @@ void uci::position(std::istringstream& ss){
   } else if(token=="fen"){
     while(ss>>token&&token!="moves") fen+=token+" ";
   } else return;
-  pos=board(fen);
+  pos.set(fen);
   while(ss>>token){
     if(const u16 move=to_move(token,pos);move){
       pos.apply_move(move);
+      pos.trim_history();
     } else{
       std::cerr<<"Invalid move: "<<token<<NL;
       break;
@@ -108,6 +147,7 @@ void uci::go(const std::string& str){
   std::scoped_lock lock(search_mutex);
   stop();
   search.time={};
+  search.stop_signal.set(false);
   search.time.start();
   std::istringstream ss(str);
   std::string token;
@@ -139,11 +179,142 @@ void uci::stop(){
 void uci::perft(std::istringstream& ss){
   i32 depth;
   ss>>depth;
+  stop();
   const auto begin=std::chrono::steady_clock::now();
-  const auto node_cnt=perft(pos,depth);
+  const perft_result r=search.perft(pos,depth);
   const auto end=std::chrono::steady_clock::now();
-  SO<<"node "<<node_cnt<<NL;
-  SO<<"time "<<std::chrono::duration<double>(end-begin).count()<<NL;
+  const double secs=std::chrono::duration<double>(end-begin).count();
+  for(const auto& [move,cnt]:r.divide) SO<<move::move_to_string(move)<<" "<<cnt<<NL;
+  SO<<"node "<<r.nodes<<NL;
+  SO<<"time "<<secs<<NL;
+  SO<<"mnps "<<SCDO(r.nodes)/std::max(secs,1e-9)/1e6<<NL;
+  for(size_t i=0;i<r.thread_nodes.size();++i){
+    SO<<"thread "<<i<<" node "<<r.thread_nodes[i]<<" tasks "<<r.thread_tasks[i]<<NL;
+  }
+}
+
+void uci::bench(std::istringstream& ss){
+  size_t hash_mb;
+  thread_id threads;
+  int depth;
+  if(!(ss>>hash_mb)) hash_mb=bench_hash;
+  if(!(ss>>threads)) threads=bench_threads;
+  if(!(ss>>depth)) depth=bench_depth;
+  std::scoped_lock lock(search_mutex);
+  stop();
+  const size_t saved_hash=search.hash.size_mb;
+  const thread_id saved_threads=search.num_threads;
+  search.set_num_threads(threads);
+  search.set_hash_size(hash_mb);
+  u64 nodes=0;
+  const auto b=std::make_unique<board>();
+  const auto begin=std::chrono::steady_clock::now();
+  for(size_t i=0;i<bench_fens.size();++i){
+    SO<<"position "<<i+1<<"/"<<bench_fens.size()<<" "<<bench_fens[i]<<NL;
+    b->set(bench_fens[i]);
+    search.time={};
+    search.stop_signal.set(false);
+    search.time.start();
+    search.time.use_depth_limit=true;
+    search.time.depth_limit=depth;
+    search.time.init_time(b->side_to_move);
+    search.best_move(*b);
+    nodes+=search.node_count();
+  }
+  const auto end=std::chrono::steady_clock::now();
+  const double secs=std::chrono::duration<double>(end-begin).count();
+  SO<<"node "<<nodes<<NL;
+  SO<<"time "<<secs<<NL;
+  SO<<"nps "<<SC<u64>(SCDO(nodes)/std::max(secs,1e-9))<<SE;
+  search.set_num_threads(saved_threads);
+  search.set_hash_size(saved_hash);
+}
+
+void uci::stats(){
+#if defined(STATS)
+  SO<<search.stats_info()<<std::flush;
+#else
+  SO<<"info string stats are not compiled in, build with stats=yes"<<SE;
+#endif
+}
+
+void uci::perftsuite(std::istringstream& ss){
+  std::string file=perftsuite_file;
+  int max_depth=max_ply;
+  if(std::string token;ss>>token){
+    if(std::all_of(token.begin(),token.end(),isdigit)) max_depth=std::stoi(token);
+    else{
+      file=token;
+      ss>>max_depth;
+    }
+  }
+  std::ifstream in(file);
+  if(!in){
+    std::cerr<<"Failed to open "<<file<<NL;
+    return;
+  }
+  stop();
+  int positions=0;
+  int passed=0;
+  int failed=0;
+  int skipped=0;
+  u64 total_nodes=0;
+  double total_time=0;
+  const auto b=std::make_unique<board>();
+  std::string line;
+  while(std::getline(in,line)){
+    std::istringstream fields(line);
+    std::string fen,field;
+    if(!std::getline(fields,fen,';')) continue;
+    fen.erase(fen.find_last_not_of(" \t\r")+1);
+    if(fen.empty()) continue;
+    b->set(fen);
+    ++positions;
+    u64 nodes=0;
+    double secs=0;
+    bool ok=true;
+    int parsed=0;
+    int run=0;
+    while(std::getline(fields,field,';')){
+      std::istringstream entry(field);
+      std::string d;
+      u64 expected;
+      if(!(entry>>d>>expected)||d.size()<2||d[0]!='D'||
+        !std::all_of(d.begin()+1,d.end(),isdigit)) continue;
+      ++parsed;
+      const int depth=std::stoi(d.substr(1));
+      if(depth>max_depth) continue;
+      ++run;
+      const auto begin=std::chrono::steady_clock::now();
+      const u64 cnt=search.perft(*b,depth,false).nodes;
+      const auto end=std::chrono::steady_clock::now();
+      nodes+=cnt;
+      secs+=std::chrono::duration<double>(end-begin).count();
+      if(cnt!=expected){
+        ok=false;
+        SO<<"position "<<positions<<" depth "<<depth<<" expected "<<expected<<" got "<<cnt<<NL;
+      }
+    }
+    if(!parsed){
+      ++failed;
+      SO<<"position "<<positions<<" error no D<n> <count> fields "<<fen<<NL;
+      continue;
+    }
+    if(!run){
+      ++skipped;
+      SO<<"position "<<positions<<" skipped no depth within "<<max_depth<<" "<<fen<<NL;
+      continue;
+    }
+    if(ok) ++passed;
+    else ++failed;
+    total_nodes+=nodes;
+    total_time+=secs;
+    SO<<"position "<<positions<<(ok?" ok":" failed")<<" node "<<nodes<<" time "<<secs
+      <<" mnps "<<SCDO(nodes)/std::max(secs,1e-9)/1e6<<" "<<fen<<NL;
+  }
+  SO<<"positions "<<positions<<" passed "<<passed<<" failed "<<failed<<" skipped "<<skipped
+    <<" node "<<total_nodes<<" time "<<total_time
+    <<" mnps "<<SCDO(total_nodes)/std::max(total_time,1e-9)/1e6<<SE;
 }
 
 u16 uci::to_move(const std::string& str,board& b){
@@ -15,9 +15,35 @@ namespace uci{
   inline bool use_nnue=true;
   constexpr int default_contempt=1;
   constexpr size_t default_hash=256;
+  constexpr size_t bench_hash=16;
+  constexpr thread_id bench_threads=1;
+  constexpr int bench_depth=12;
   constexpr thread_id default_threads=1;
   inline board pos;
+  inline const std::string perftsuite_file="perftsuite.epd";
   inline const std::string start_fen="rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+  inline const std::vector<std::string> bench_fens={
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+  "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+  "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+  "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+  "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+  "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+  "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+  "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+  "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+  "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+  "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+  "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+  "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+  "r1b2rk1/2q1b1pp/p2ppn2/1p6/3QP3/1BN1B3/PPP3PP/R4RK1 w - - 0 12",
+  "5rk1/q6p/2p3bR/1pPp1rP1/1P1Pp3/P3B1Q1/1K3P2/R7 w - - 93 90",
+  "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/8 b - - 0 1",
+  "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+  "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+  "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1"
+  };
   inline int contempt=default_contempt;
   inline search_info search;
   inline std::jthread thread;
@@ -26,18 +52,25 @@ namespace uci{
   {.name="Hash",.type="spin",.default_value=default_hash,.min_value=1,.max_value=max_hash_size},
   {.name="Threads",.type="spin",.default_value=default_threads,.min_value=1,.max_value=max_threads},
   {.name="Contempt",.type="spin",.default_value=default_contempt,.min_value=-100,.max_value=100},
-  {.name="UseNNUE",.type="check",.default_value=true,.min_value=0,.max_value=1}
+  {.name="UseNNUE",.type="check",.default_value=true,.min_value=0,.max_value=1},
+  {.name="LargePages",.type="check",.default_value=false,.min_value=0,.max_value=1},
+  {.name="PinThreads",.type="check",.default_value=false,.min_value=0,.max_value=1}
   };
   u16 to_move(const std::string& str,board& b);
+  void bench(std::istringstream& ss);
   void get_bestmove();
   void go(const std::string& str);
+  void hash_info();
+  void hash_stats();
   void info();
   void init();
   void loop();
   void newgame();
   void perft(std::istringstream& ss);
+  void perftsuite(std::istringstream& ss);
   void position(std::istringstream& ss);
   void setoption(std::istringstream& ss);
+  void stats();
   void stop();
 }
 